@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Userspace benchmark for the Ayn platform driver: N threads read the
+ * hwmon sensor attributes as fast as they can for a fixed time, the way
+ * several monitoring tools polling at once would. Reports the read rate,
+ * the read latency and, when debugfs is readable, the EC transactions
+ * issued meanwhile from ayn-platform/ec_stats.
+ *
+ * Works against the EC or the mock backend (ec_backend=mock).
+ *
+ *   $ make bench BENCH_READERS=8 BENCH_SECONDS=10
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HWMON_ROOT      "/sys/class/hwmon"
+#define HWMON_NAME      "aynec"
+#define EC_STATS        "/sys/kernel/debug/ayn-platform/ec_stats"
+#define LAT_BUCKETS     32      /* log2 microseconds */
+
+static const char *const attrs[] = {
+        "temp1_input", "temp2_input", "temp3_input", "temp4_input",
+        "temp5_input", "fan1_input", "pwm1", "pwm1_enable",
+};
+
+#define NATTRS (sizeof(attrs) / sizeof(attrs[0]))
+
+struct reader {
+        pthread_t thread;
+        int fds[NATTRS];
+        uint64_t reads;
+        uint64_t errors;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint64_t lat[LAT_BUCKETS];
+};
+
+static atomic_bool stop;
+
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int lat_bucket(uint64_t ns)
+{
+        uint64_t us = ns / 1000;
+        int b = 0;
+
+        while (us && b < LAT_BUCKETS - 1) {
+                us >>= 1;
+                b++;
+        }
+        return b;
+}
+
+static void *reader_fn(void *arg)
+{
+        struct reader *r = arg;
+        char buf[32];
+        uint64_t t0, dt;
+        size_t i;
+
+        while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+                for (i = 0; i < NATTRS; i++) {
+                        t0 = now_ns();
+                        if (pread(r->fds[i], buf, sizeof(buf), 0) < 0)
+                                r->errors++;
+                        dt = now_ns() - t0;
+
+                        r->reads++;
+                        r->total_ns += dt;
+                        if (dt > r->max_ns)
+                                r->max_ns = dt;
+                        r->lat[lat_bucket(dt)]++;
+                }
+        }
+
+        return NULL;
+}
+
+static int find_hwmon(char *path, size_t len)
+{
+        struct dirent *de;
+        char name[64];
+        DIR *dir;
+        FILE *f;
+        int ret = -ENODEV;
+
+        dir = opendir(HWMON_ROOT);
+        if (!dir)
+                return -errno;
+
+        while ((de = readdir(dir))) {
+                if (de->d_name[0] == '.')
+                        continue;
+
+                snprintf(path, len, HWMON_ROOT "/%s/name", de->d_name);
+                f = fopen(path, "r");
+                if (!f)
+                        continue;
+                if (fgets(name, sizeof(name), f) &&
+                    !strncmp(name, HWMON_NAME "\n", sizeof(HWMON_NAME))) {
+                        snprintf(path, len, HWMON_ROOT "/%s", de->d_name);
+                        ret = 0;
+                }
+                fclose(f);
+                if (!ret)
+                        break;
+        }
+
+        closedir(dir);
+        return ret;
+}
+
+/* Clears the per register counters, false without debugfs access */
+static int ec_stats_reset(void)
+{
+        int fd = open(EC_STATS, O_WRONLY);
+        int ok;
+
+        if (fd < 0)
+                return 0;
+        ok = write(fd, "0", 1) == 1;
+        close(fd);
+        return ok;
+}
+
+/* Sum of the xfers column, -1 on error */
+static long long ec_stats_xfers(void)
+{
+        long long reads, writes, elided, hits, xfers;
+        long long total = 0;
+        char line[256];
+        unsigned int reg;
+        FILE *f;
+
+        f = fopen(EC_STATS, "r");
+        if (!f)
+                return -1;
+
+        while (fgets(line, sizeof(line), f)) {
+                if (sscanf(line, "0x%x %lld %lld %lld %lld %lld", &reg, &reads,
+                           &writes, &elided, &hits, &xfers) == 6)
+                        total += xfers;
+        }
+
+        fclose(f);
+        return total;
+}
+
+static uint64_t percentile(const uint64_t *lat, uint64_t count, int pct)
+{
+        uint64_t want = (count * pct + 99) / 100;
+        uint64_t seen = 0;
+        int b;
+
+        for (b = 0; b < LAT_BUCKETS; b++) {
+                seen += lat[b];
+                if (seen >= want)
+                        return b ? 1ULL << b : 1;
+        }
+        return 1ULL << (LAT_BUCKETS - 1);
+}
+
+static void usage(const char *prog)
+{
+        fprintf(stderr,
+                "usage: %s [-n readers] [-t seconds] [-d hwmon directory]\n",
+                prog);
+        exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+        uint64_t lat[LAT_BUCKETS] = { 0 };
+        uint64_t reads = 0, errors = 0, total_ns = 0, max_ns = 0;
+        struct reader *readers;
+        char dir[PATH_MAX] = "";
+        char path[PATH_MAX + 32];
+        long long xfers;
+        int nreaders = 4;
+        int seconds = 10;
+        int stats;
+        double elapsed;
+        uint64_t t0;
+        size_t j;
+        int opt;
+        int i;
+
+        while ((opt = getopt(argc, argv, "n:t:d:")) != -1) {
+                switch (opt) {
+                case 'n':
+                        nreaders = atoi(optarg);
+                        break;
+                case 't':
+                        seconds = atoi(optarg);
+                        break;
+                case 'd':
+                        snprintf(dir, sizeof(dir), "%s", optarg);
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if (nreaders < 1 || seconds < 1)
+                usage(argv[0]);
+
+        if (!*dir && find_hwmon(dir, sizeof(dir))) {
+                fprintf(stderr, "no " HWMON_NAME " hwmon device, is ayn-platform loaded?\n");
+                return EXIT_FAILURE;
+        }
+
+        readers = calloc(nreaders, sizeof(*readers));
+        if (!readers)
+                return EXIT_FAILURE;
+
+        for (i = 0; i < nreaders; i++) {
+                for (j = 0; j < NATTRS; j++) {
+                        snprintf(path, sizeof(path), "%s/%s", dir, attrs[j]);
+                        readers[i].fds[j] = open(path, O_RDONLY);
+                        if (readers[i].fds[j] < 0) {
+                                perror(path);
+                                return EXIT_FAILURE;
+                        }
+                }
+        }
+
+        stats = ec_stats_reset();
+        t0 = now_ns();
+
+        for (i = 0; i < nreaders; i++) {
+                if (pthread_create(&readers[i].thread, NULL, reader_fn,
+                                   &readers[i])) {
+                        fprintf(stderr, "failed to start reader %d\n", i);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        sleep(seconds);
+        atomic_store(&stop, 1);
+
+        for (i = 0; i < nreaders; i++) {
+                pthread_join(readers[i].thread, NULL);
+                reads += readers[i].reads;
+                errors += readers[i].errors;
+                total_ns += readers[i].total_ns;
+                if (readers[i].max_ns > max_ns)
+                        max_ns = readers[i].max_ns;
+                for (j = 0; j < LAT_BUCKETS; j++)
+                        lat[j] += readers[i].lat[j];
+                for (j = 0; j < NATTRS; j++)
+                        close(readers[i].fds[j]);
+        }
+
+        elapsed = (now_ns() - t0) / 1e9;
+        xfers = stats ? ec_stats_xfers() : -1;
+
+        printf("hwmon:      %s\n", dir);
+        printf("readers:    %d\n", nreaders);
+        printf("duration:   %.2f s\n", elapsed);
+        printf("reads:      %llu (%llu errors)\n", (unsigned long long)reads,
+               (unsigned long long)errors);
+        printf("reads/s:    %.0f\n", reads / elapsed);
+        if (reads)
+                printf("latency:    mean %.1f us, p50 <%llu us, p99 <%llu us, max %.1f us\n",
+                       total_ns / 1e3 / reads,
+                       (unsigned long long)percentile(lat, reads, 50),
+                       (unsigned long long)percentile(lat, reads, 99),
+                       max_ns / 1e3);
+        if (xfers >= 0)
+                printf("EC xfers:   %lld (%.1f/s, %.4f per read)\n", xfers,
+                       xfers / elapsed, reads ? (double)xfers / reads : 0.0);
+        else
+                printf("EC xfers:   n/a, needs read access to " EC_STATS "\n");
+
+        free(readers);
+        return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for the Ayn platform driver.
+ *
+ * They count the EC transactions behind the operations userspace issues
+ * most often, against the mock EC backend, so the driver has to be loaded
+ * with it first:
+ *
+ *   # modprobe ayn-platform ec_backend=mock
+ *   # modprobe ayn-platform-test
+ *
+ * The background sampler is stopped for the duration of the suite so it
+ * doesn't add transactions of its own.
+ */
+
+#include <kunit/test.h>
+#include <linux/device/driver.h>
+#include <linux/hwmon.h>
+#include <linux/module.h>
+#include <linux/version.h>
+
+#include "ayn-platform.h"
+#include "ayn-platform-test.h"
+
+static int ayn_test_init(struct kunit *test)
+{
+        if (!ayn_ec_is_mock())
+                kunit_skip(test, "ayn-platform not loaded with ec_backend=mock");
+
+        return 0;
+}
+
+/* One sweep of every sensor is a single bulk read */
+static void ayn_test_sweep(struct kunit *test)
+{
+        unsigned int xfers = ayn_ec_mock_xfers();
+        long val;
+
+        ayn_sample_sensors();
+        KUNIT_EXPECT_EQ(test, ayn_ec_mock_xfers() - xfers, 1);
+
+        KUNIT_EXPECT_EQ(test, ayn_platform_read(NULL, hwmon_temp,
+                                                hwmon_temp_input, 0, &val), 0);
+}
+
+/* hwmon reads are served from the last sweep */
+static void ayn_test_hwmon_reads(struct kunit *test)
+{
+        unsigned int xfers;
+        long val;
+        int i;
+        int ch;
+
+        ayn_sample_sensors();
+        xfers = ayn_ec_mock_xfers();
+
+        for (i = 0; i < 10; i++) {
+                for (ch = 0; ch < AYN_TEMP_SENSOR_COUNT; ch++)
+                        KUNIT_EXPECT_EQ(test,
+                                        ayn_platform_read(NULL, hwmon_temp,
+                                                          hwmon_temp_input,
+                                                          ch, &val), 0);
+                KUNIT_EXPECT_EQ(test, ayn_platform_read(NULL, hwmon_fan,
+                                                        hwmon_fan_input,
+                                                        0, &val), 0);
+                KUNIT_EXPECT_EQ(test, ayn_platform_read(NULL, hwmon_pwm,
+                                                        hwmon_pwm_input,
+                                                        0, &val), 0);
+                KUNIT_EXPECT_EQ(test, ayn_platform_read(NULL, hwmon_pwm,
+                                                        hwmon_pwm_enable,
+                                                        0, &val), 0);
+        }
+
+        KUNIT_EXPECT_EQ(test, ayn_ec_mock_xfers() - xfers, 0);
+}
+
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_LEDS)
+/* Rewriting the LED color the EC already holds costs nothing */
+static void ayn_test_led_elision(struct kunit *test)
+{
+        u8 regs[AYN_LED_REGS] = { 0x10, 0x20, 0x30 };
+        unsigned int xfers;
+
+        ec_shadow_invalidate_all();
+
+        xfers = ayn_ec_mock_xfers();
+        KUNIT_ASSERT_EQ(test, ayn_led_regs_write(regs), 0);
+        KUNIT_EXPECT_EQ(test, ayn_ec_mock_xfers() - xfers, 1);
+
+        xfers = ayn_ec_mock_xfers();
+        KUNIT_ASSERT_EQ(test, ayn_led_regs_write(regs), 0);
+        KUNIT_EXPECT_EQ(test, ayn_ec_mock_xfers() - xfers, 0);
+
+        regs[1] = 0x40;
+        xfers = ayn_ec_mock_xfers();
+        KUNIT_ASSERT_EQ(test, ayn_led_regs_write(regs), 0);
+        KUNIT_EXPECT_EQ(test, ayn_ec_mock_xfers() - xfers, 1);
+}
+
+/* The EC only latches a color when the mode command follows it */
+static void ayn_test_led_latch(struct kunit *test)
+{
+        u8 regs[AYN_LED_REGS] = { 0x10, 0x20, 0x30 };
+        u64 writes;
+
+        ec_shadow_invalidate_all();
+
+        writes = ayn_ec_reg_writes(AYN_LED_MODE_REG);
+        KUNIT_ASSERT_EQ(test, ayn_led_regs_write(regs), 0);
+        KUNIT_EXPECT_EQ(test, ayn_ec_reg_writes(AYN_LED_MODE_REG) - writes, 1);
+
+        regs[0] = 0x50;
+        writes = ayn_ec_reg_writes(AYN_LED_MODE_REG);
+        KUNIT_ASSERT_EQ(test, ayn_led_regs_write(regs), 0);
+        KUNIT_EXPECT_EQ(test, ayn_ec_reg_writes(AYN_LED_MODE_REG) - writes, 1);
+
+        writes = ayn_ec_reg_writes(AYN_LED_MODE_REG);
+        KUNIT_ASSERT_EQ(test, ayn_led_regs_write(regs), 0);
+        KUNIT_EXPECT_EQ(test, ayn_ec_reg_writes(AYN_LED_MODE_REG) - writes, 0);
+}
+#endif
+
+static struct kunit_case ayn_test_cases[] = {
+        KUNIT_CASE(ayn_test_sweep),
+        KUNIT_CASE(ayn_test_hwmon_reads),
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_LEDS)
+        KUNIT_CASE(ayn_test_led_elision),
+        KUNIT_CASE(ayn_test_led_latch),
+#endif
+        {}
+};
+
+static int ayn_test_suite_init(struct kunit_suite *suite)
+{
+        /* The driver probes asynchronously */
+        wait_for_device_probe();
+
+        if (ayn_ec_is_mock())
+                ayn_sampler_stop(NULL);
+
+        return 0;
+}
+
+static void ayn_test_suite_exit(struct kunit_suite *suite)
+{
+        if (ayn_ec_is_mock())
+                ayn_sampler_start();
+}
+
+static struct kunit_suite ayn_test_suite = {
+        .name = "ayn-platform",
+        .init = ayn_test_init,
+        .suite_init = ayn_test_suite_init,
+        .suite_exit = ayn_test_suite_exit,
+        .test_cases = ayn_test_cases,
+};
+
+kunit_test_suite(ayn_test_suite);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+MODULE_IMPORT_NS("EXPORTED_FOR_KUNIT_TESTING");
+#else
+MODULE_IMPORT_NS(EXPORTED_FOR_KUNIT_TESTING);
+#endif
+
+MODULE_DESCRIPTION("KUnit tests for the Ayn platform driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Driver internals reached by the KUnit tests in ayn-platform-test.c.
+ *
+ * With CONFIG_KUNIT these lose their static and are exported in the
+ * EXPORTED_FOR_KUNIT_TESTING namespace, see <kunit/visibility.h>.
+ */
+
+#ifndef _AYN_PLATFORM_TEST_H
+#define _AYN_PLATFORM_TEST_H
+
+#include <linux/hwmon.h>
+#include <linux/types.h>
+
+#if IS_ENABLED(CONFIG_KUNIT)
+u64 ayn_ec_reg_writes(u8 reg);
+void ec_shadow_invalidate_all(void);
+void ayn_sample_sensors(void);
+void ayn_sampler_start(void);
+void ayn_sampler_stop(void *data);
+int ayn_platform_read(struct device *dev, enum hwmon_sensor_types type,
+                      u32 attr, int channel, long *val);
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_LEDS)
+int ayn_led_regs_write(u8 *regs);
+#endif
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_EC_MOCK)
+bool ayn_ec_is_mock(void);
+unsigned int ayn_ec_mock_xfers(void);
+#endif
+#endif
+
+#endif
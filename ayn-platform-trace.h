@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints for EC transactions issued by the Ayn platform driver.
+ *
+ * Every transaction records the first register, the number of registers
+ * covered, the time spent waiting for the ACPI global lock, the time spent
+ * in EC I/O while holding it, and the result.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ayn_platform
+
+#if !defined(_AYN_PLATFORM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AYN_PLATFORM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(ayn_ec_xfer,
+
+        TP_PROTO(u8 reg, int size, u64 lock_ns, u64 io_ns, int ret),
+
+        TP_ARGS(reg, size, lock_ns, io_ns, ret),
+
+        TP_STRUCT__entry(
+                __field(u8, reg)
+                __field(int, size)
+                __field(u64, lock_ns)
+                __field(u64, io_ns)
+                __field(int, ret)
+        ),
+
+        TP_fast_assign(
+                __entry->reg = reg;
+                __entry->size = size;
+                __entry->lock_ns = lock_ns;
+                __entry->io_ns = io_ns;
+                __entry->ret = ret;
+        ),
+
+        TP_printk("reg=0x%02x size=%d lock_ns=%llu io_ns=%llu ret=%d",
+                  __entry->reg, __entry->size, __entry->lock_ns,
+                  __entry->io_ns, __entry->ret)
+);
+
+DEFINE_EVENT(ayn_ec_xfer, ayn_ec_read,
+        TP_PROTO(u8 reg, int size, u64 lock_ns, u64 io_ns, int ret),
+        TP_ARGS(reg, size, lock_ns, io_ns, ret)
+);
+
+DEFINE_EVENT(ayn_ec_xfer, ayn_ec_write,
+        TP_PROTO(u8 reg, int size, u64 lock_ns, u64 io_ns, int ret),
+        TP_ARGS(reg, size, lock_ns, io_ns, ret)
+);
+
+#endif /* _AYN_PLATFORM_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ayn-platform-trace
+#include <trace/define_trace.h>
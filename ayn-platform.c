@@ -15,29 +15,67 @@
  * Copyright (C) 2023-2024 Derek J. Clark <derekjohn.clark@gmail.com>
  */
 
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <kunit/visibility.h>
 #include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/dmi.h>
 #include <linux/hwmon-sysfs.h>
+#include <linux/hrtimer.h>
 #include <linux/hwmon.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/init.h>
+#include <linux/jiffies.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/led-class-multicolor.h>
 #include <linux/leds.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
+#include <linux/platform_profile.h>
 #include <linux/processor.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/thermal.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "ayn-platform.h"
+#include "ayn-platform-test.h"
 
-/* Handle ACPI lock mechanism */
-static u32 ayn_mutex;
+#define CREATE_TRACE_POINTS
+#include "ayn-platform-trace.h"
 
+/* Handle ACPI lock mechanism, the handle is kept by each transaction */
 #define ACPI_LOCK_DELAY_MS 500
+#define ACPI_LOCK_DELAY_MAX_MS 10000
+
+static unsigned int lock_timeout_ms = ACPI_LOCK_DELAY_MS;
+module_param(lock_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(lock_timeout_ms,
+                 "Time in ms to wait for the ACPI global lock, max 10000 (default: 500)");
+
+static bool lock_global_acpi_lock(u32 *handle) {
+        u16 timeout = min_t(unsigned int, READ_ONCE(lock_timeout_ms),
+                            ACPI_LOCK_DELAY_MAX_MS);
 
-static bool lock_global_acpi_lock(void) {
-        return ACPI_SUCCESS(acpi_acquire_global_lock(ACPI_LOCK_DELAY_MS, &ayn_mutex));
+        return ACPI_SUCCESS(acpi_acquire_global_lock(timeout, handle));
 }
 
-static bool unlock_global_acpi_lock(void) {
-         return ACPI_SUCCESS(acpi_release_global_lock(ayn_mutex));
+static bool unlock_global_acpi_lock(u32 handle) {
+         return ACPI_SUCCESS(acpi_release_global_lock(handle));
 }
 
 enum ayn_model {
@@ -46,43 +84,6 @@ enum ayn_model {
         ayn_loki_zero,
 };
 
-static enum ayn_model model;
-
-/* EC Teperature Sensors */
-#define AYN_SENSOR_BAT_TEMP_REG         0x04  /* Battery */
-#define AYN_SENSOR_CHARGE_TEMP_REG      0x07  /* Charger IC */
-#define AYN_SENSOR_MB_TEMP_REG          0x05  /* Motherboard */
-#define AYN_SENSOR_PROC_TEMP_REG        0x09  /* CPU Core */
-#define AYN_SENSOR_VCORE_TEMP_REG       0x08  /* vCore */
-
-/* Fan reading and PWM */
-#define AYN_SENSOR_PWM_FAN_ENABLE_REG   0x10  /* PWM operating mode */
-#define AYN_SENSOR_PWM_FAN_SET_REG      0x11  /* PWM duty cycle */
-#define AYN_SENSOR_PWM_FAN_SPEED_REG    0x20  /* Fan speed */
-
-/* EC controlled fan curve registers */
-#define AYN_SENSOR_PWM_FAN_SPEED_1_REG  0x12
-#define AYN_SENSOR_PWM_FAN_SPEED_2_REG  0x14
-#define AYN_SENSOR_PWM_FAN_SPEED_3_REG  0x16
-#define AYN_SENSOR_PWM_FAN_SPEED_4_REG  0x18
-#define AYN_SENSOR_PWM_FAN_SPEED_5_REG  0x1A
-#define AYN_SENSOR_PWM_FAN_TEMP_1_REG   0x13
-#define AYN_SENSOR_PWM_FAN_TEMP_2_REG   0x15
-#define AYN_SENSOR_PWM_FAN_TEMP_3_REG   0x17
-#define AYN_SENSOR_PWM_FAN_TEMP_4_REG   0x19
-#define AYN_SENSOR_PWM_FAN_TEMP_5_REG   0x1B
-
-/* EC Controlled RGB registers */
-#define AYN_LED_MC_B_REG                0xB2 /* Blue, range 0x00-0xFF */
-#define AYN_LED_MC_G_REG                0xB1 /* Green, range 0x00-0xFF */
-#define AYN_LED_MC_R_REG                0xB0 /* Red, range 0x00-0xFF */
-#define AYN_LED_MODE_REG                0xB3 /* RGB Mode */
-
-/* RGB Mode values */
-#define AYN_LED_MODE_BREATH             0x00 /* Default breathing mode */
-#define AYN_LED_MODE_WRITE              0xAA /* User defined mode */
-#define AYN_LED_MODE_WRITE_ENABLED      0x55 /* Return value when probed */
-
 enum led_mode {
         breath = 0,
         write,
@@ -116,534 +117,4759 @@ static const struct dmi_system_id dmi_table[] = {
     {},
 };
 
-/* Helper functions to handle EC read/write */
-static int read_from_ec(u8 reg, int size, long *val)
-{
-        int i;
-        int ret;
-        u8 buffer;
+/* Per model register map
+ *
+ * Each user visible EC value is described by its register, the right shift
+ * from the user scale to the EC scale and the largest user value. The
+ * descriptor is picked once at probe from the DMI match, so the I/O paths
+ * are plain table lookups and a new model only needs a new table.
+ */
+#define AYN_FAN_CURVE_POINTS            5
+#define AYN_FAN_CURVE_REGS              (AYN_FAN_CURVE_POINTS * 2)
 
-        if (!lock_global_acpi_lock())
-                return -EBUSY;
+struct ayn_ec_reg_desc {
+        u8 reg;
+        u8 shift;               /* EC value = user value >> shift */
+        u16 max;                /* largest user value */
+};
 
-        *val = 0;
-        for (i = 0; i < size; i++) {
-                ret = ec_read(reg + i, &buffer);
-                if (ret)
-                        return ret;
-                *val <<= i * 8;
-                *val += buffer;
+struct ayn_model_desc {
+        struct ayn_ec_reg_desc pwm;
+        /* pwm1_auto_point[1-5]_pwm then pwm1_auto_point[1-5]_temp */
+        struct ayn_ec_reg_desc auto_point[AYN_FAN_CURVE_REGS];
+};
+
+#define AYN_AUTO_POINTS(_pwm_shift)                                     \
+        {                                                               \
+                { AYN_SENSOR_PWM_FAN_SPEED_1_REG, _pwm_shift, 255 },    \
+                { AYN_SENSOR_PWM_FAN_SPEED_2_REG, _pwm_shift, 255 },    \
+                { AYN_SENSOR_PWM_FAN_SPEED_3_REG, _pwm_shift, 255 },    \
+                { AYN_SENSOR_PWM_FAN_SPEED_4_REG, _pwm_shift, 255 },    \
+                { AYN_SENSOR_PWM_FAN_SPEED_5_REG, _pwm_shift, 255 },    \
+                { AYN_SENSOR_PWM_FAN_TEMP_1_REG, 0, 100 },              \
+                { AYN_SENSOR_PWM_FAN_TEMP_2_REG, 0, 100 },              \
+                { AYN_SENSOR_PWM_FAN_TEMP_3_REG, 0, 100 },              \
+                { AYN_SENSOR_PWM_FAN_TEMP_4_REG, 0, 100 },              \
+                { AYN_SENSOR_PWM_FAN_TEMP_5_REG, 0, 100 },              \
         }
 
-        if (!unlock_global_acpi_lock())
-                return -EBUSY;
+/* Models without a table of their own get the EC duty cycle unscaled */
+static const struct ayn_model_desc ayn_generic_desc = {
+        .pwm = { AYN_SENSOR_PWM_FAN_SET_REG, 0, 255 },
+        .auto_point = AYN_AUTO_POINTS(1),
+};
 
-        return 0;
-}
+/* EC max duty cycle is 128 */
+static const struct ayn_model_desc ayn_loki_desc = {
+        .pwm = { AYN_SENSOR_PWM_FAN_SET_REG, 1, 255 },
+        .auto_point = AYN_AUTO_POINTS(1),
+};
 
-static int write_to_ec(u8 reg, u8 val)
+static const struct ayn_model_desc *const ayn_model_descs[] = {
+        [ayn_loki_max] = &ayn_loki_desc,
+        [ayn_loki_minipro] = &ayn_loki_desc,
+        [ayn_loki_zero] = &ayn_loki_desc,
+};
+
+static const struct ayn_model_desc *ayn_desc = &ayn_generic_desc;
+
+static void ayn_model_init(void)
 {
-        int ret;
+        const struct dmi_system_id *match;
+        enum ayn_model model;
+
+        match = dmi_first_match(dmi_table);
+        if (!match)
+                return;
 
-        if (!lock_global_acpi_lock())
-                return -EBUSY;
+        model = (enum ayn_model)(unsigned long)match->driver_data;
+        if (model < ARRAY_SIZE(ayn_model_descs) && ayn_model_descs[model])
+                ayn_desc = ayn_model_descs[model];
+}
 
-        ret = ec_write(reg, val);
+/* EC register cache */
+#define AYN_EC_REG_COUNT                256
 
-        if (!unlock_global_acpi_lock())
-                return -EBUSY;
+static unsigned int update_interval = 500;
+module_param(update_interval, uint, 0644);
+MODULE_PARM_DESC(update_interval,
+                 "Sensor sampling interval and EC cache lifetime in ms, 0 disables caching (default: 500)");
 
-        return ret;
+static struct {
+        struct mutex lock;
+        u8 val[AYN_EC_REG_COUNT];
+        unsigned long stamp[AYN_EC_REG_COUNT];
+        DECLARE_BITMAP(valid, AYN_EC_REG_COUNT);
+        unsigned int writes;            /* bumped by every invalidation */
+} ec_cache = {
+        .lock = __MUTEX_INITIALIZER(ec_cache.lock),
+};
+
+/* Shadow copy of the writable EC registers
+ *
+ * Holds the last value the driver wrote to a register so that redundant
+ * writes can be elided. Registers the EC may change on its own are
+ * invalidated when that can happen, and the whole shadow is dropped on
+ * resume to force a resync. Command registers don't hold what was written
+ * and are never compared against it.
+ */
+static struct {
+        struct mutex lock;
+        u8 val[AYN_EC_REG_COUNT];
+        DECLARE_BITMAP(valid, AYN_EC_REG_COUNT);
+} ec_shadow = {
+        .lock = __MUTEX_INITIALIZER(ec_shadow.lock),
+};
+
+/* The LED mode register takes a command: the EC latches the colors on a
+ * write of AYN_LED_MODE_WRITE and reads back AYN_LED_MODE_WRITE_ENABLED. */
+static bool ec_shadow_is_command(int reg)
+{
+        return reg == AYN_LED_MODE_REG;
 }
 
-/* Thermal Sensor Functions*/
-struct thermal_sensor {
-        char *name;
-        int reg;
+static void ec_shadow_invalidate(u8 reg, int len)
+{
+        mutex_lock(&ec_shadow.lock);
+        bitmap_clear(ec_shadow.valid, reg, len);
+        mutex_unlock(&ec_shadow.lock);
+}
+
+VISIBLE_IF_KUNIT void ec_shadow_invalidate_all(void)
+{
+        mutex_lock(&ec_shadow.lock);
+        bitmap_zero(ec_shadow.valid, AYN_EC_REG_COUNT);
+        mutex_unlock(&ec_shadow.lock);
+}
+EXPORT_SYMBOL_IF_KUNIT(ec_shadow_invalidate_all);
+
+/* Contiguous EC register range */
+struct ayn_ec_range {
+        u8 reg;
+        u8 len;
 };
 
-static struct thermal_sensor thermal_sensors[] = {
-        {"Battery", AYN_SENSOR_BAT_TEMP_REG},
-        {"Motherboard", AYN_SENSOR_MB_TEMP_REG},
-        {"Charger IC", AYN_SENSOR_CHARGE_TEMP_REG},
-        {"vCore", AYN_SENSOR_VCORE_TEMP_REG},
-        {"CPU Core", AYN_SENSOR_PROC_TEMP_REG},
-        {0,}
+/* Registers are refreshed per group on a cache miss, so a full sensor
+ * sweep or fan curve read costs a single global lock round-trip. */
+static const struct ayn_ec_range ayn_sensor_ranges[] = {
+        { AYN_SENSOR_BAT_TEMP_REG, 6 },         /* 0x04-0x09 temperatures */
+        { AYN_SENSOR_PWM_FAN_ENABLE_REG, 2 },   /* 0x10-0x11 PWM mode, duty */
+        { AYN_SENSOR_PWM_FAN_SPEED_REG, 2 },    /* 0x20-0x21 fan speed */
+};
+
+/* The fan speed is a multi-byte value, confirmed within the sweep */
+#define AYN_SENSOR_FAN_RANGE            (&ayn_sensor_ranges[2])
+
+static const struct ayn_ec_range ayn_curve_ranges[] = {
+        { AYN_SENSOR_PWM_FAN_SPEED_1_REG, 10 }, /* 0x12-0x1B fan curve */
 };
 
-static long thermal_sensor_temp(u8 reg, long *val)
+struct ayn_ec_group {
+        const struct ayn_ec_range *ranges;
+        int count;
+        const struct ayn_ec_range *settle;      /* re-read until stable */
+};
+
+static const struct ayn_ec_group ayn_ec_groups[] = {
+        { ayn_sensor_ranges, ARRAY_SIZE(ayn_sensor_ranges),
+          AYN_SENSOR_FAN_RANGE },
+        { ayn_curve_ranges, ARRAY_SIZE(ayn_curve_ranges) },
+};
+
+static bool ec_range_overlaps(const struct ayn_ec_range *range, u8 reg,
+                              int size)
 {
-        long retval;
-        retval = read_from_ec(reg, 1, val);
+        return reg < range->reg + range->len && range->reg < reg + size;
+}
 
-        if (retval)
-                return retval;
+static const struct ayn_ec_group *ec_cache_group(u8 reg)
+{
+        const struct ayn_ec_range *range;
+        int i;
+        int j;
 
-        *val = *val * (long)1000; // convert from hwmon expected millidegree to degree
-        return retval;
+        for (i = 0; i < ARRAY_SIZE(ayn_ec_groups); i++) {
+                for (j = 0; j < ayn_ec_groups[i].count; j++) {
+                        range = &ayn_ec_groups[i].ranges[j];
+                        if (reg >= range->reg && reg < range->reg + range->len)
+                                return &ayn_ec_groups[i];
+                }
+        }
+
+        return NULL;
+}
+
+/* Taken under ec_cache.lock, so that a refill that sampled the write count
+ * before this cannot mark the registers valid again in between. */
+static void ec_cache_invalidate(u8 reg, int size)
+{
+        mutex_lock(&ec_cache.lock);
+        ec_cache.writes++;
+        bitmap_clear(ec_cache.valid, reg, size);
+        mutex_unlock(&ec_cache.lock);
+}
+
+/* EC backends
+ *
+ * All EC access goes through ayn_ec. The "ec" backend is the ACPI EC behind
+ * the ACPI global lock, "mock" an in-memory register file that lets the
+ * driver run, and be measured, without the hardware. Its per transaction
+ * latency, a failure every fail_every register accesses and the register
+ * contents are set through debugfs. The mock also loads on machines that
+ * don't match the DMI table. It is only built with
+ * CONFIG_AYN_PLATFORM_EC_MOCK, which the KUnit tests select.
+ */
+struct ayn_ec_ops {
+        const char *name;
+        bool (*lock)(u32 *handle);
+        bool (*unlock)(u32 handle);
+        int (*read)(u8 reg, u8 *val);
+        int (*write)(u8 reg, u8 val);
 };
 
-static ssize_t thermal_sensor_show(struct device *dev,
-                                   struct device_attribute *attr, char *buf)
+static const struct ayn_ec_ops ayn_ec_acpi_ops = {
+        .name = "ec",
+        .lock = lock_global_acpi_lock,
+        .unlock = unlock_global_acpi_lock,
+        .read = ec_read,
+        .write = ec_write,
+};
+
+static const struct ayn_ec_ops *ayn_ec = &ayn_ec_acpi_ops;
+
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_EC_MOCK)
+
+static char *ec_backend = "ec";
+module_param(ec_backend, charp, 0444);
+MODULE_PARM_DESC(ec_backend,
+                 "EC backend, \"ec\" or \"mock\" for testing without the hardware (default: ec)");
+
+static struct {
+        u8 regs[AYN_EC_REG_COUNT];
+        u32 latency_us;                 /* added to every transaction */
+        u32 fail_every;                 /* fail every nth access, 0 never */
+        atomic_t accesses;
+        atomic_t xfers;                 /* lock holds, one per transaction */
+} ec_mock = {
+        /* Plausible idle values: warm sensors, EC fan control, LEDs on */
+        .regs = {
+                [AYN_SENSOR_BAT_TEMP_REG] = 30,
+                [AYN_SENSOR_MB_TEMP_REG] = 38,
+                [AYN_SENSOR_CHARGE_TEMP_REG] = 35,
+                [AYN_SENSOR_VCORE_TEMP_REG] = 45,
+                [AYN_SENSOR_PROC_TEMP_REG] = 44,
+                [AYN_SENSOR_PWM_FAN_ENABLE_REG] = 0x01,
+                [AYN_SENSOR_PWM_FAN_SET_REG] = 32,
+                [AYN_SENSOR_PWM_FAN_SPEED_REG] = 0x0b,
+                [AYN_SENSOR_PWM_FAN_SPEED_REG + 1] = 0xb8,
+                [AYN_LED_MODE_REG] = AYN_LED_MODE_WRITE_ENABLED,
+        },
+};
+
+static bool ayn_ec_mock_lock(u32 *handle)
 {
-        int index;
-        long retval;
-        long val;
-        index = to_sensor_dev_attr(attr)->index;
+        u32 latency = READ_ONCE(ec_mock.latency_us);
 
-        retval = thermal_sensor_temp(thermal_sensors[index].reg, &val);
-        if (retval)
-                return retval;
+        atomic_inc(&ec_mock.xfers);
+        if (latency)
+                fsleep(latency);
 
-        return sprintf(buf, "%ld\n", val);
+        return true;
 }
 
-static ssize_t thermal_sensor_label(struct device *dev,
-                                    struct device_attribute *attr, char *buf)
+static bool ayn_ec_mock_unlock(u32 handle)
 {
-        int index;
-        index = to_sensor_dev_attr(attr)->index;
-        return sprintf(buf, "%s\n", thermal_sensors[index].name);
+        return true;
 }
 
-/* PWM mode functions */
-/* Callbacks for pwm_auto_point attributes */
-static ssize_t pwm_curve_store(struct device *dev,
-                               struct device_attribute *attr, const char *buf,
-                               size_t count)
+static int ayn_ec_mock_fault(void)
 {
-        int index;
-        int retval;
-        int val;
-        u8 reg;
+        u32 every = READ_ONCE(ec_mock.fail_every);
 
-        retval = kstrtoint(buf, 0, &val);
-        if (retval)
-                return retval;
+        if (every && (u32)atomic_inc_return(&ec_mock.accesses) % every == 0)
+                return -EIO;
 
-        index = to_sensor_dev_attr(attr)->index;
-        switch (index) {
-        case 0:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_1_REG;
-                break;
-        case 1:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_2_REG;
-                break;
-        case 2:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_3_REG;
-                break;
-        case 3:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_4_REG;
-                break;
-        case 4:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_5_REG;
-                break;
-        case 5:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_1_REG;
-                break;
-        case 6:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_2_REG;
-                break;
-        case 7:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_3_REG;
-                break;
-        case 8:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_4_REG;
-                break;
-        case 9:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_5_REG;
-                break;
-        default:
-                return -EINVAL;
-        }
+        return 0;
+}
 
-        switch (index) {
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-        case 4:
-                if (val < 0 || val > 255)
-                        return -EINVAL;
-                val = val >> 1;
-                break;
-        case 5:
-        case 6:
-        case 7:
-        case 8:
-        case 9:
-                if (val < 0 || val > 100)
-                        return -EINVAL;
-                break;
-        default:
-                return -EINVAL;
-        }
+static int ayn_ec_mock_read(u8 reg, u8 *val)
+{
+        int ret = ayn_ec_mock_fault();
 
-        retval = write_to_ec(reg, val);
-        if (retval)
-                return retval;
-        return count;
+        if (!ret)
+                *val = READ_ONCE(ec_mock.regs[reg]);
+
+        return ret;
 }
 
-static ssize_t pwm_curve_show(struct device *dev, struct device_attribute *attr,
-                              char *buf)
+static int ayn_ec_mock_write(u8 reg, u8 val)
 {
-        int index;
-        int retval;
-        long val;
-        u8 reg;
+        int ret = ayn_ec_mock_fault();
 
-        index = to_sensor_dev_attr(attr)->index;
-        switch (index) {
-        case 0:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_1_REG;
-                break;
-        case 1:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_2_REG;
-                break;
-        case 2:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_3_REG;
-                break;
-        case 3:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_4_REG;
-                break;
-        case 4:
-                reg = AYN_SENSOR_PWM_FAN_SPEED_5_REG;
-                break;
-        case 5:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_1_REG;
-                break;
-        case 6:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_2_REG;
-                break;
-        case 7:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_3_REG;
-                break;
-        case 8:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_4_REG;
-                break;
-        case 9:
-                reg = AYN_SENSOR_PWM_FAN_TEMP_5_REG;
-                break;
-        default:
-                return -EINVAL;
-        }
+        if (!ret)
+                WRITE_ONCE(ec_mock.regs[reg], val);
 
-        retval = read_from_ec(reg, 1, &val);
-        if (retval)
-                return retval;
+        return ret;
+}
 
-        switch (index) {
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-        case 4:
-                val = val << 1;
-                break;
-        default:
-                break;
-         }
+static const struct ayn_ec_ops ayn_ec_mock_ops = {
+        .name = "mock",
+        .lock = ayn_ec_mock_lock,
+        .unlock = ayn_ec_mock_unlock,
+        .read = ayn_ec_mock_read,
+        .write = ayn_ec_mock_write,
+};
 
-        return sysfs_emit(buf, "%ld\n", val);
+VISIBLE_IF_KUNIT bool ayn_ec_is_mock(void)
+{
+        return ayn_ec == &ayn_ec_mock_ops;
 }
+EXPORT_SYMBOL_IF_KUNIT(ayn_ec_is_mock);
 
-/* Manual provides direct control of the PWM */
-static int ayn_pwm_manual(void)
+#if IS_ENABLED(CONFIG_KUNIT)
+/* Only the tests count transactions against the mock */
+unsigned int ayn_ec_mock_xfers(void)
 {
-        return write_to_ec(AYN_SENSOR_PWM_FAN_ENABLE_REG, 0x00);
+        return atomic_read(&ec_mock.xfers);
 }
+EXPORT_SYMBOL_IF_KUNIT(ayn_ec_mock_xfers);
+#endif
 
-/* Auto provides EC full control of the PWM */
-static int ayn_pwm_auto(void)
+static int ayn_ec_backend_init(void)
 {
-        return write_to_ec(AYN_SENSOR_PWM_FAN_ENABLE_REG, 0x01);
+        if (sysfs_streq(ec_backend, ayn_ec_acpi_ops.name))
+                ayn_ec = &ayn_ec_acpi_ops;
+        else if (sysfs_streq(ec_backend, ayn_ec_mock_ops.name))
+                ayn_ec = &ayn_ec_mock_ops;
+        else
+                return -EINVAL;
+
+        if (ayn_ec_is_mock())
+                pr_notice("using the mock EC backend, not the hardware\n");
+
+        return 0;
 }
 
-/* User defined mode allows users to set a custom 5 point
- * fan curve in the EC which uses the CPU temperature. */
-static int ayn_pwm_user(void)
+#else
+
+static bool ayn_ec_is_mock(void)
 {
-        return write_to_ec(AYN_SENSOR_PWM_FAN_ENABLE_REG, 0x02);
+        return false;
 }
 
-/* Temperature sensor and fan curve attributes */
-static SENSOR_DEVICE_ATTR(temp1_input, S_IRUGO, thermal_sensor_show, NULL, 0);
-static SENSOR_DEVICE_ATTR(temp1_label, S_IRUGO, thermal_sensor_label, NULL, 0);
-static SENSOR_DEVICE_ATTR(temp2_input, S_IRUGO, thermal_sensor_show, NULL, 1);
-static SENSOR_DEVICE_ATTR(temp2_label, S_IRUGO, thermal_sensor_label, NULL, 1);
-static SENSOR_DEVICE_ATTR(temp3_input, S_IRUGO, thermal_sensor_show, NULL, 2);
-static SENSOR_DEVICE_ATTR(temp3_label, S_IRUGO, thermal_sensor_label, NULL, 2);
-static SENSOR_DEVICE_ATTR(temp4_input, S_IRUGO, thermal_sensor_show, NULL, 3);
-static SENSOR_DEVICE_ATTR(temp4_label, S_IRUGO, thermal_sensor_label, NULL, 3);
-static SENSOR_DEVICE_ATTR(temp5_input, S_IRUGO, thermal_sensor_show, NULL, 4);
-static SENSOR_DEVICE_ATTR(temp5_label, S_IRUGO, thermal_sensor_label, NULL, 4);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point1_pwm, pwm_curve, 0);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point2_pwm, pwm_curve, 1);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point3_pwm, pwm_curve, 2);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point4_pwm, pwm_curve, 3);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point5_pwm, pwm_curve, 4);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point1_temp, pwm_curve, 5);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point2_temp, pwm_curve, 6);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point3_temp, pwm_curve, 7);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point4_temp, pwm_curve, 8);
-static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point5_temp, pwm_curve, 9);
+static int ayn_ec_backend_init(void)
+{
+        return 0;
+}
 
-static struct attribute *ayn_sensors_attrs[] = {
-        &sensor_dev_attr_temp1_input.dev_attr.attr,
-        &sensor_dev_attr_temp1_label.dev_attr.attr,
-        &sensor_dev_attr_temp2_input.dev_attr.attr,
-        &sensor_dev_attr_temp2_label.dev_attr.attr,
-        &sensor_dev_attr_temp3_input.dev_attr.attr,
-        &sensor_dev_attr_temp3_label.dev_attr.attr,
-        &sensor_dev_attr_temp4_input.dev_attr.attr,
-        &sensor_dev_attr_temp4_label.dev_attr.attr,
-        &sensor_dev_attr_temp5_input.dev_attr.attr,
-        &sensor_dev_attr_temp5_label.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point1_pwm.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point2_pwm.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point3_pwm.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point4_pwm.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point5_pwm.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point1_temp.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point2_temp.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point3_temp.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point4_temp.dev_attr.attr,
-        &sensor_dev_attr_pwm1_auto_point5_temp.dev_attr.attr,
-        NULL,
+#endif
+
+/* EC transaction latency
+ *
+ * Each transaction is timed in two parts: waiting for the ACPI global lock,
+ * which firmware SMM and other ACPI users contend on, and the EC I/O done
+ * while holding it. Both are emitted through the ayn_ec_read/ayn_ec_write
+ * tracepoints and accumulated in log2 microsecond histograms shown in
+ * debugfs.
+ */
+#define AYN_EC_HIST_BUCKETS             21
+
+enum ayn_ec_dir {
+        AYN_EC_READ,
+        AYN_EC_WRITE,
+        AYN_EC_DIRS,
 };
 
-ATTRIBUTE_GROUPS(ayn_sensors);
+static struct {
+        atomic64_t lock[AYN_EC_DIRS][AYN_EC_HIST_BUCKETS];
+        atomic64_t io[AYN_EC_DIRS][AYN_EC_HIST_BUCKETS];
+} ec_hist;
 
-/* Callbacks for fan1/pwm attributes */
-static umode_t ayn_ec_hwmon_is_visible(const void *drvdata,
-                                       enum hwmon_sensor_types type, u32 attr,
-                                       int channel)
+/* EC error counters, shown in debugfs */
+static struct {
+        atomic64_t lock_timeouts;
+        atomic64_t unlock_errors;
+        atomic64_t io_errors;
+        atomic64_t retries;
+        atomic64_t failures;
+} ec_errors;
+
+/* Per register EC statistics, shown in debugfs
+ *
+ * reads and writes count register accesses that reached the EC, elided the
+ * writes the shadow made unnecessary and cache_hits the reads served from
+ * the cache. Transactions, with their errors, lock timeouts and time spent
+ * including the lock wait, are counted on their first register.
+ */
+struct ayn_ec_reg_stats {
+        atomic64_t reads;
+        atomic64_t writes;
+        atomic64_t elided;
+        atomic64_t cache_hits;
+        atomic64_t xfers;
+        atomic64_t errors;
+        atomic64_t lock_timeouts;
+        atomic64_t time_ns;
+        atomic64_t max_ns;
+};
+
+static struct ayn_ec_reg_stats ec_reg_stats[AYN_EC_REG_COUNT];
+
+#if IS_ENABLED(CONFIG_KUNIT)
+u64 ayn_ec_reg_writes(u8 reg)
 {
-        switch (type) {
-        case hwmon_fan:
-                return 0444;
-        case hwmon_pwm:
-                return 0644;
-        default:
-                return 0;
-        }
+        return atomic64_read(&ec_reg_stats[reg].writes);
 }
+EXPORT_SYMBOL_IF_KUNIT(ayn_ec_reg_writes);
+#endif
 
-static int ayn_platform_read(struct device *dev, enum hwmon_sensor_types type,
-                             u32 attr, int channel, long *val)
+static void ec_stats_max(atomic64_t *max, s64 ns)
 {
-        int ret;
+        s64 old = atomic64_read(max);
 
-        switch (type) {
-        case hwmon_fan:
-                switch (attr) {
-                case hwmon_fan_input:
-                        return read_from_ec(AYN_SENSOR_PWM_FAN_SPEED_REG, 2, val);
-                default:
-                        break;
-                }
-                break;
-        case hwmon_pwm:
-                switch (attr) {
-                case hwmon_pwm_enable:
-                        ret = read_from_ec(AYN_SENSOR_PWM_FAN_ENABLE_REG, 1, val);
-                        switch (*val) {
-                        /* EC uses 0 for manual and 1 for automatic,
-                           reflect hwmon usage instead */
-                        case 0:
-                                *val = 1;
-                                break;
-                        case 1:
-                                *val = 0;
-                                break;
-                        default:
-                                break;
-                        }
-                        return ret;
-                case hwmon_pwm_input:
-                        ret = read_from_ec(AYN_SENSOR_PWM_FAN_SET_REG, 1, val);
+        while (ns > old && !atomic64_try_cmpxchg(max, &old, ns))
+                ;
+}
+
+struct ayn_ec_xfer {
+        enum ayn_ec_dir dir;
+        u8 reg;
+        int size;
+        ktime_t start;
+        u64 lock_ns;
+        u32 lock;                       /* global lock handle */
+};
+
+/* Bucket 0 counts transactions under 1us, bucket n those in
+ * [2^(n-1), 2^n) us and the last one everything above. */
+static void ec_hist_add(atomic64_t *hist, u64 ns)
+{
+        int bucket = fls64(div_u64(ns, NSEC_PER_USEC));
+
+        atomic64_inc(&hist[min(bucket, AYN_EC_HIST_BUCKETS - 1)]);
+}
+
+static void ayn_ec_xfer_report(struct ayn_ec_xfer *xfer, u64 io_ns, int ret)
+{
+        ec_hist_add(ec_hist.lock[xfer->dir], xfer->lock_ns);
+        if (io_ns)
+                ec_hist_add(ec_hist.io[xfer->dir], io_ns);
+
+        if (xfer->dir == AYN_EC_WRITE)
+                trace_ayn_ec_write(xfer->reg, xfer->size, xfer->lock_ns, io_ns, ret);
+        else
+                trace_ayn_ec_read(xfer->reg, xfer->size, xfer->lock_ns, io_ns, ret);
+}
+
+/* Take the global lock for a transaction covering size registers from reg */
+static bool ayn_ec_xfer_begin(struct ayn_ec_xfer *xfer, enum ayn_ec_dir dir,
+                              u8 reg, int size)
+{
+        ktime_t now;
+        bool locked;
+
+        xfer->dir = dir;
+        xfer->reg = reg;
+        xfer->size = size;
+        xfer->start = ktime_get();
+
+        locked = ayn_ec->lock(&xfer->lock);
+
+        now = ktime_get();
+        xfer->lock_ns = ktime_to_ns(ktime_sub(now, xfer->start));
+        xfer->start = now;
+
+        if (!locked) {
+                atomic64_inc(&ec_errors.lock_timeouts);
+                atomic64_inc(&ec_reg_stats[reg].lock_timeouts);
+                ayn_ec_xfer_report(xfer, 0, -EBUSY);
+        }
+
+        return locked;
+}
+
+/* Always releases the lock taken by ayn_ec_xfer_begin() */
+static int ayn_ec_xfer_end(struct ayn_ec_xfer *xfer, int ret)
+{
+        struct ayn_ec_reg_stats *stats = &ec_reg_stats[xfer->reg];
+        u64 io_ns = ktime_to_ns(ktime_sub(ktime_get(), xfer->start));
+
+        if (ret)
+                atomic64_inc(&ec_errors.io_errors);
+
+        if (!ayn_ec->unlock(xfer->lock)) {
+                atomic64_inc(&ec_errors.unlock_errors);
+                ret = -EBUSY;
+        }
+
+        atomic64_inc(&stats->xfers);
+        if (ret)
+                atomic64_inc(&stats->errors);
+        atomic64_add(xfer->lock_ns + io_ns, &stats->time_ns);
+        ec_stats_max(&stats->max_ns, xfer->lock_ns + io_ns);
+
+        ayn_ec_xfer_report(xfer, io_ns, ret);
+        return ret;
+}
+
+/* EC transactions
+ *
+ * A transaction takes the global lock, runs its I/O callback and always
+ * releases the lock again, whatever the outcome. Transient EC errors are
+ * retried up to ec_retries times with exponential backoff, sleeping with the
+ * lock released so other users, including firmware, can make progress.
+ * Failing to get the lock within lock_timeout_ms is not retried, the caller
+ * has already waited long enough.
+ */
+#define AYN_EC_BACKOFF_MIN_US           500
+#define AYN_EC_BACKOFF_MAX_US           8000
+
+static unsigned int ec_retries = 3;
+module_param(ec_retries, uint, 0644);
+MODULE_PARM_DESC(ec_retries,
+                 "Number of retries for a failed EC transaction (default: 3)");
+
+static bool ayn_ec_error_transient(int ret)
+{
+        return ret != -ENODEV && ret != -EINVAL;
+}
+
+static int ayn_ec_transaction(enum ayn_ec_dir dir, u8 reg, int size,
+                              int (*io)(void *ctx), void *ctx)
+{
+        struct ayn_ec_xfer xfer;
+        unsigned int backoff = AYN_EC_BACKOFF_MIN_US;
+        unsigned int attempt;
+        int ret;
+
+        for (attempt = 0;; attempt++) {
+                if (!ayn_ec_xfer_begin(&xfer, dir, reg, size))
+                        return -EBUSY;
+
+                ret = ayn_ec_xfer_end(&xfer, io(ctx));
+                if (!ret)
+                        return 0;
+
+                if (!ayn_ec_error_transient(ret) ||
+                    attempt >= READ_ONCE(ec_retries))
+                        break;
+
+                atomic64_inc(&ec_errors.retries);
+                usleep_range(backoff, backoff * 2);
+                backoff = min(backoff * 2, AYN_EC_BACKOFF_MAX_US);
+        }
+
+        atomic64_inc(&ec_errors.failures);
+        return ret;
+}
+
+/* Single register accesses, the caller holds the ACPI global lock */
+static int ayn_ec_read_reg(u8 reg, u8 *val)
+{
+        atomic64_inc(&ec_reg_stats[reg].reads);
+        return ayn_ec->read(reg, val);
+}
+
+static int ayn_ec_write_reg(u8 reg, u8 val)
+{
+        atomic64_inc(&ec_reg_stats[reg].writes);
+        return ayn_ec->write(reg, val);
+}
+
+/* Copy len consecutive registers starting at reg into buf. The caller must
+ * hold the ACPI global lock. */
+static int __read_from_ec_bulk(u8 reg, u8 *buf, int len)
+{
+        int i;
+        int ret;
+
+        for (i = 0; i < len; i++) {
+                ret = ayn_ec_read_reg(reg + i, &buf[i]);
+                if (ret)
+                        return ret;
+        }
+
+        return 0;
+}
+
+/* Registers are stored in image at their offset from base */
+struct ayn_ec_read_ctx {
+        const struct ayn_ec_range *ranges;
+        int count;
+        u8 *image;
+        u8 base;
+        const struct ayn_ec_range *settle;      /* NULL or one of ranges */
+        bool settled;
+};
+
+/* The EC latches multi-byte values one register at a time and may update
+ * them in between, so a value can tear across bytes. The settle range,
+ * already read, is re-read under the same lock hold until two consecutive
+ * reads agree.
+ */
+#define AYN_EC_STABLE_TRIES             4
+
+static int __read_from_ec_settle(struct ayn_ec_read_ctx *ctx)
+{
+        const struct ayn_ec_range *range = ctx->settle;
+        u8 *val = &ctx->image[range->reg - ctx->base];
+        u8 next[sizeof(long)];
+        int ret;
+        int i;
+
+        ctx->settled = false;
+        for (i = 0; i < AYN_EC_STABLE_TRIES; i++) {
+                ret = __read_from_ec_bulk(range->reg, next, range->len);
+                if (ret)
+                        return ret;
+                if (!memcmp(next, val, range->len)) {
+                        ctx->settled = true;
+                        return 0;
+                }
+                memcpy(val, next, range->len);
+        }
+
+        return 0;
+}
+
+static int ayn_ec_read_io(void *data)
+{
+        struct ayn_ec_read_ctx *ctx = data;
+        int i;
+        int ret;
+
+        for (i = 0; i < ctx->count; i++) {
+                ret = __read_from_ec_bulk(ctx->ranges[i].reg,
+                                          &ctx->image[ctx->ranges[i].reg - ctx->base],
+                                          ctx->ranges[i].len);
+                if (ret)
+                        return ret;
+        }
+
+        if (ctx->settle)
+                return __read_from_ec_settle(ctx);
+
+        return 0;
+}
+
+/* Read several register ranges under a single global lock hold, confirming
+ * the settle range, if any, in the same hold. Values are stored in image at
+ * their register offset. Returns -EAGAIN, with image filled in, when the
+ * settle value never agreed. */
+static int read_from_ec_settled(const struct ayn_ec_range *ranges, int count,
+                                const struct ayn_ec_range *settle, u8 *image)
+{
+        struct ayn_ec_read_ctx ctx = {
+                .ranges = ranges,
+                .count = count,
+                .image = image,
+                .settle = settle,
+        };
+        int size = 0;
+        int ret;
+        int i;
+
+        for (i = 0; i < count; i++)
+                size += ranges[i].len;
+
+        ret = ayn_ec_transaction(AYN_EC_READ, ranges[0].reg, size,
+                                 ayn_ec_read_io, &ctx);
+        if (!ret && settle && !ctx.settled)
+                return -EAGAIN;
+
+        return ret;
+}
+
+static int read_from_ec_ranges(const struct ayn_ec_range *ranges, int count,
+                               u8 *image)
+{
+        return read_from_ec_settled(ranges, count, NULL, image);
+}
+
+static int read_from_ec_bulk(u8 reg, u8 *buf, int len)
+{
+        struct ayn_ec_range range = { reg, len };
+        struct ayn_ec_read_ctx ctx = {
+                .ranges = &range,
+                .count = 1,
+                .image = buf,
+                .base = reg,
+        };
+
+        return ayn_ec_transaction(AYN_EC_READ, reg, len, ayn_ec_read_io, &ctx);
+}
+
+/* Read a big-endian value of up to sizeof(long) registers */
+static int __maybe_unused read_from_ec(u8 reg, int size, long *val)
+{
+        u8 buf[sizeof(long)];
+        int ret;
+        int i;
+
+        if (size > sizeof(buf))
+                return -EINVAL;
+
+        ret = read_from_ec_bulk(reg, buf, size);
+        if (ret)
+                return ret;
+
+        *val = 0;
+        for (i = 0; i < size; i++) {
+                *val <<= 8;
+                *val += buf[i];
+        }
+
+        return 0;
+}
+
+struct ayn_ec_write_ctx {
+        const struct ayn_ec_range *ranges;
+        int count;
+        const u8 *image;
+        u8 base;
+        unsigned long *dirty;           /* indexed by register */
+};
+
+/* Registers are dropped from dirty once written, so a retry only repeats
+ * the writes that did not complete. Caller holds ec_shadow.lock. */
+static int ayn_ec_write_io(void *data)
+{
+        struct ayn_ec_write_ctx *ctx = data;
+        const struct ayn_ec_range *range;
+        u8 val;
+        int ret;
+        int reg;
+
+        for (range = ctx->ranges; range < ctx->ranges + ctx->count; range++) {
+                for (reg = range->reg; reg < range->reg + range->len; reg++) {
+                        if (!test_bit(reg, ctx->dirty))
+                                continue;
+                        val = ctx->image[reg - ctx->base];
+                        ret = ayn_ec_write_reg(reg, val);
                         if (ret)
                                 return ret;
-                        switch (model) {
-                        case ayn_loki_max:
-                        case ayn_loki_minipro:
-                        case ayn_loki_zero:
-                                *val = *val << 1; /* EC max value is 128 */
-                                break;
-                        default:
-                                break;
+                        ec_shadow.val[reg] = val;
+                        set_bit(reg, ec_shadow.valid);
+                        __clear_bit(reg, ctx->dirty);
+                }
+        }
+
+        return 0;
+}
+
+/* Write several register ranges from image, register reg stored at
+ * image[reg - base], in range order under a single global lock hold.
+ * Registers whose shadow already holds the requested value are skipped,
+ * and the global lock is not taken at all when nothing changes. Command
+ * registers are always written unless everything else was skipped. */
+static int __write_to_ec_ranges(const struct ayn_ec_range *ranges, int count,
+                                const u8 *image, u8 base)
+{
+        DECLARE_BITMAP(dirty, AYN_EC_REG_COUNT);
+        struct ayn_ec_write_ctx ctx = {
+                .ranges = ranges,
+                .count = count,
+                .image = image,
+                .base = base,
+                .dirty = dirty,
+        };
+        const struct ayn_ec_range *range;
+        int others = 0;
+        int size = 0;
+        int ret = 0;
+        int reg;
+
+        bitmap_zero(dirty, AYN_EC_REG_COUNT);
+
+        mutex_lock(&ec_shadow.lock);
+
+        for (range = ranges; range < ranges + count; range++) {
+                for (reg = range->reg; reg < range->reg + range->len; reg++) {
+                        if (ec_shadow_is_command(reg))
+                                continue;
+                        others++;
+                        if (test_bit(reg, ec_shadow.valid) &&
+                            ec_shadow.val[reg] == image[reg - base]) {
+                                atomic64_inc(&ec_reg_stats[reg].elided);
+                                continue;
                         }
-                        return 0;
-                default:
-                        break;
+                        __set_bit(reg, dirty);
+                        size++;
                 }
-                break;
-        default:
-                break;
         }
-        return -EOPNOTSUPP;
+
+        /* A command latches the registers written along with it, so it is
+         * only elided together with all of them */
+        for (range = ranges; range < ranges + count; range++) {
+                for (reg = range->reg; reg < range->reg + range->len; reg++) {
+                        if (!ec_shadow_is_command(reg))
+                                continue;
+                        if (others && !size) {
+                                atomic64_inc(&ec_reg_stats[reg].elided);
+                                continue;
+                        }
+                        __set_bit(reg, dirty);
+                        size++;
+                }
+        }
+
+        if (!size)
+                goto out;
+
+        ret = ayn_ec_transaction(AYN_EC_WRITE, ranges[0].reg, size,
+                                 ayn_ec_write_io, &ctx);
+
+        for (range = ranges; range < ranges + count; range++)
+                ec_cache_invalidate(range->reg, range->len);
+
+out:
+        mutex_unlock(&ec_shadow.lock);
+        return ret;
+}
+
+/* Write len consecutive registers starting at reg */
+static int write_to_ec_block(u8 reg, const u8 *buf, int len)
+{
+        struct ayn_ec_range range = { reg, len };
+
+        return __write_to_ec_ranges(&range, 1, buf, reg);
+}
+
+struct ayn_ec_restore_ctx {
+        const struct ayn_ec_range *ranges;
+        int count;
+        const u8 *image;
+};
+
+/* Read every range back into the shadow, then write the registers that
+ * differ from image. Both passes are idempotent, so a retry starts over.
+ * Caller holds ec_shadow.lock. */
+static int ayn_ec_restore_io(void *data)
+{
+        struct ayn_ec_restore_ctx *ctx = data;
+        const struct ayn_ec_range *range;
+        int ret;
+        int reg;
+        int i;
+
+        for (i = 0; i < ctx->count; i++) {
+                range = &ctx->ranges[i];
+                ret = __read_from_ec_bulk(range->reg, &ec_shadow.val[range->reg],
+                                          range->len);
+                if (ret)
+                        return ret;
+                bitmap_set(ec_shadow.valid, range->reg, range->len);
+        }
+
+        for (i = 0; i < ctx->count; i++) {
+                range = &ctx->ranges[i];
+                for (reg = range->reg; reg < range->reg + range->len; reg++) {
+                        if (ec_shadow.val[reg] == ctx->image[reg]) {
+                                atomic64_inc(&ec_reg_stats[reg].elided);
+                                continue;
+                        }
+                        ret = ayn_ec_write_reg(reg, ctx->image[reg]);
+                        if (ret) {
+                                clear_bit(reg, ec_shadow.valid);
+                                return ret;
+                        }
+                        ec_shadow.val[reg] = ctx->image[reg];
+                }
+        }
+
+        return 0;
+}
+
+/* Bring several register ranges back to the values in image, stored at
+ * their register offset, under a single global lock hold. Ranges are
+ * processed in order and only the registers the EC lost are written. */
+static int restore_ec_ranges(const struct ayn_ec_range *ranges, int count,
+                             const u8 *image)
+{
+        struct ayn_ec_restore_ctx ctx = {
+                .ranges = ranges,
+                .count = count,
+                .image = image,
+        };
+        int size = 0;
+        int ret;
+        int i;
+
+        for (i = 0; i < count; i++)
+                size += ranges[i].len;
+
+        mutex_lock(&ec_shadow.lock);
+        ret = ayn_ec_transaction(AYN_EC_WRITE, ranges[0].reg, size,
+                                 ayn_ec_restore_io, &ctx);
+        for (i = 0; i < count; i++)
+                ec_cache_invalidate(ranges[i].reg, ranges[i].len);
+        mutex_unlock(&ec_shadow.lock);
+
+        return ret;
+}
+
+static int write_to_ec(u8 reg, u8 val)
+{
+        return write_to_ec_block(reg, &val, 1);
+}
+
+/* Cached EC reads
+ *
+ * Sensor registers are polled by several readers at once while the EC only
+ * updates them a few times per second. A reading is kept for update_interval
+ * milliseconds and any reader inside that window is served from memory
+ * without taking the ACPI global lock.
+ *
+ * Refills are coalesced: a reader missing the cache while a refill of the
+ * same group is in flight waits for it and shares its result instead of
+ * issuing the same transaction again. ec_cache.lock only guards the cache
+ * itself and is dropped across the EC I/O, so the ACPI global lock is the
+ * only lock held while talking to the EC.
+ */
+static struct {
+        bool busy;
+        int ret;                        /* result of the last refill */
+        unsigned int gen;               /* bumped when a refill completes */
+        u8 image[AYN_EC_REG_COUNT];
+} ec_inflight[ARRAY_SIZE(ayn_ec_groups)];
+
+static DECLARE_WAIT_QUEUE_HEAD(ec_inflight_wq);
+static atomic_t ec_coalesced;          /* reads that shared a refill */
+
+static void ec_cache_mark(u8 reg, int len, unsigned long stamp)
+{
+        int i;
+
+        for (i = 0; i < len; i++) {
+                ec_cache.stamp[reg + i] = stamp;
+                set_bit(reg + i, ec_cache.valid);
+        }
+}
+
+/* Refresh the group containing reg, or just [reg, reg + size) for
+ * registers outside any group. Caller holds ec_cache.lock, which is
+ * released while the EC is read. A value invalidated by a write during the
+ * read is still returned but not cached. -EAGAIN means the group's settle
+ * value never agreed; it holds the last read but is not cached, everything
+ * else is. */
+static int ec_cache_refill(u8 reg, int size)
+{
+        const struct ayn_ec_group *group = ec_cache_group(reg);
+        const struct ayn_ec_range *range;
+        unsigned long stamp;
+        unsigned int writes;
+        unsigned int gen;
+        u8 *image;
+        int ret;
+        int i;
+
+        if (!group) {
+                u8 buf[sizeof(long)];
+
+                if (size > sizeof(buf))
+                        return -EINVAL;
+
+                writes = ec_cache.writes;
+                mutex_unlock(&ec_cache.lock);
+                ret = read_from_ec_bulk(reg, buf, size);
+                mutex_lock(&ec_cache.lock);
+                if (ret)
+                        return ret;
+
+                memcpy(&ec_cache.val[reg], buf, size);
+                if (ec_cache.writes == writes)
+                        ec_cache_mark(reg, size, jiffies);
+                return 0;
+        }
+
+        i = group - ayn_ec_groups;
+        if (ec_inflight[i].busy) {
+                gen = ec_inflight[i].gen;
+                atomic_inc(&ec_coalesced);
+                mutex_unlock(&ec_cache.lock);
+                wait_event(ec_inflight_wq, READ_ONCE(ec_inflight[i].gen) != gen);
+                mutex_lock(&ec_cache.lock);
+                return ec_inflight[i].ret;
+        }
+
+        ec_inflight[i].busy = true;
+        image = ec_inflight[i].image;
+        writes = ec_cache.writes;
+        mutex_unlock(&ec_cache.lock);
+
+        ret = read_from_ec_settled(group->ranges, group->count, group->settle,
+                                   image);
+
+        mutex_lock(&ec_cache.lock);
+        if (!ret || ret == -EAGAIN) {
+                stamp = jiffies;
+                for (range = group->ranges;
+                     range < group->ranges + group->count; range++) {
+                        memcpy(&ec_cache.val[range->reg], &image[range->reg],
+                               range->len);
+                        if (ret && range == group->settle)
+                                continue;
+                        if (ec_cache.writes == writes)
+                                ec_cache_mark(range->reg, range->len, stamp);
+                }
+        }
+
+        ec_inflight[i].ret = ret;
+        ec_inflight[i].busy = false;
+        WRITE_ONCE(ec_inflight[i].gen, ec_inflight[i].gen + 1);
+        wake_up_all(&ec_inflight_wq);
+
+        return ret;
+}
+
+static int read_from_ec_cached(u8 reg, int size, long *val)
+{
+        unsigned long ttl = msecs_to_jiffies(READ_ONCE(update_interval));
+        int i;
+        int ret = 0;
+
+        mutex_lock(&ec_cache.lock);
+
+        for (i = 0; i < size; i++) {
+                if (!ttl || !test_bit(reg + i, ec_cache.valid) ||
+                    time_after(jiffies, ec_cache.stamp[reg + i] + ttl))
+                        break;
+        }
+
+        if (i < size) {
+                ret = ec_cache_refill(reg, size);
+                /* Only the value that never settled is in doubt */
+                if (ret == -EAGAIN &&
+                    !ec_range_overlaps(ec_cache_group(reg)->settle, reg, size))
+                        ret = 0;
+                if (ret)
+                        goto out;
+        } else {
+                for (i = 0; i < size; i++)
+                        atomic64_inc(&ec_reg_stats[reg + i].cache_hits);
+        }
+
+        *val = 0;
+        for (i = 0; i < size; i++) {
+                *val <<= 8;
+                *val += ec_cache.val[reg + i];
+        }
+
+out:
+        mutex_unlock(&ec_cache.lock);
+        return ret;
+}
+
+/* Thermal Sensor Functions*/
+struct thermal_sensor {
+        const char *name;
+        int reg;
+};
+
+static const struct thermal_sensor thermal_sensors[] = {
+        {"Battery", AYN_SENSOR_BAT_TEMP_REG},
+        {"Motherboard", AYN_SENSOR_MB_TEMP_REG},
+        {"Charger IC", AYN_SENSOR_CHARGE_TEMP_REG},
+        {"vCore", AYN_SENSOR_VCORE_TEMP_REG},
+        {"CPU Core", AYN_SENSOR_PROC_TEMP_REG},
+};
+
+static_assert(ARRAY_SIZE(thermal_sensors) == AYN_TEMP_SENSOR_COUNT);
+
+/* Background sensor sampling
+ *
+ * A delayed work item sweeps every sensor register once per update_interval
+ * into a snapshot, and sysfs reads are served from that snapshot. EC load
+ * stays constant regardless of how many readers poll hwmon.
+ */
+#define AYN_SAMPLE_INTERVAL_MIN_MS      100
+#define AYN_SAMPLE_INTERVAL_MAX_MS      60000
+
+struct ayn_sensor_snapshot {
+        u8 temp[AYN_TEMP_SENSOR_COUNT];  /* degrees Celsius */
+        u16 fan_speed;                   /* RPM */
+        u16 fan_average;                 /* RPM, moving average */
+        u8 pwm;                          /* EC duty cycle [0-128] */
+        u8 pwm_mode;                     /* EC PWM operating mode */
+        unsigned long stamp;
+        int error;
+};
+
+static DEFINE_SEQLOCK(snapshot_lock);
+static struct ayn_sensor_snapshot snapshot;
+
+/* Moving average of the fan speed, only touched by the sampler */
+#define AYN_FAN_AVERAGE_MAX             32
+
+static unsigned int fan_average_samples = 8;
+module_param(fan_average_samples, uint, 0644);
+MODULE_PARM_DESC(fan_average_samples,
+                 "Number of samples averaged in fan1_average, max 32 (default: 8)");
+
+static struct {
+        u16 rpm[AYN_FAN_AVERAGE_MAX];
+        unsigned int window;
+        unsigned int pos;
+        unsigned int count;
+        u32 sum;
+} fan_average;
+
+static void ayn_snapshot_get(struct ayn_sensor_snapshot *snap)
+{
+        unsigned int seq;
+
+        do {
+                seq = read_seqbegin(&snapshot_lock);
+                *snap = snapshot;
+        } while (read_seqretry(&snapshot_lock, seq));
+}
+
+static u16 ayn_fan_average(u16 rpm)
+{
+        unsigned int window = clamp_val(READ_ONCE(fan_average_samples), 1,
+                                        AYN_FAN_AVERAGE_MAX);
+
+        if (window != fan_average.window) {
+                memset(&fan_average, 0, sizeof(fan_average));
+                fan_average.window = window;
+        }
+
+        if (fan_average.count == window)
+                fan_average.sum -= fan_average.rpm[fan_average.pos];
+        else
+                fan_average.count++;
+
+        fan_average.rpm[fan_average.pos] = rpm;
+        fan_average.sum += rpm;
+        fan_average.pos = (fan_average.pos + 1) % window;
+
+        return DIV_ROUND_CLOSEST(fan_average.sum, fan_average.count);
+}
+
+VISIBLE_IF_KUNIT void ayn_sample_sensors(void)
+{
+        struct ayn_sensor_snapshot snap = {};
+        struct ayn_sensor_snapshot prev;
+        bool unsettled;
+        int i;
+
+        /* One transaction, fan speed confirmation included */
+        mutex_lock(&ec_cache.lock);
+        snap.error = ec_cache_refill(AYN_SENSOR_BAT_TEMP_REG, 1);
+        unsettled = snap.error == -EAGAIN;
+        if (unsettled)
+                snap.error = 0;
+        if (!snap.error) {
+                for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++)
+                        snap.temp[i] = ec_cache.val[thermal_sensors[i].reg];
+                snap.fan_speed = ec_cache.val[AYN_SENSOR_PWM_FAN_SPEED_REG] << 8 |
+                                 ec_cache.val[AYN_SENSOR_PWM_FAN_SPEED_REG + 1];
+                snap.pwm = ec_cache.val[AYN_SENSOR_PWM_FAN_SET_REG];
+                snap.pwm_mode = ec_cache.val[AYN_SENSOR_PWM_FAN_ENABLE_REG];
+        }
+        mutex_unlock(&ec_cache.lock);
+
+        if (unsettled) {
+                /* Never settled, keep the last good reading */
+                ayn_snapshot_get(&prev);
+                snap.fan_speed = prev.fan_speed;
+        }
+
+        if (!snap.error)
+                snap.fan_average = ayn_fan_average(snap.fan_speed);
+        snap.stamp = jiffies;
+
+        write_seqlock(&snapshot_lock);
+        if (snap.error)
+                snapshot.error = snap.error;
+        else
+                snapshot = snap;
+        write_sequnlock(&snapshot_lock);
+}
+EXPORT_SYMBOL_IF_KUNIT(ayn_sample_sensors);
+
+/* Sensor history
+ *
+ * Every sample is also appended to a ring of history_records fixed size
+ * records in a vmalloc_user() buffer, exposed read only through the
+ * debugfs history file for mmap(). The buffer starts with a header, records
+ * follow at header.offset. header.head counts the records written so far,
+ * record n lives in slot n % header.records and carries n in its seq field.
+ * A slot is rewritten with seq set to AYN_HISTORY_SEQ_BUSY first, so a
+ * reader that sees the same expected seq before and after copying a record
+ * got a consistent one.
+ */
+#define AYN_HISTORY_MAGIC               0x484e5941      /* "AYNH" */
+#define AYN_HISTORY_VERSION             1
+#define AYN_HISTORY_MAX_RECORDS         65536
+#define AYN_HISTORY_SEQ_BUSY            U64_MAX
+
+static unsigned int history_records = 1024;
+module_param(history_records, uint, 0444);
+MODULE_PARM_DESC(history_records,
+                 "Number of samples kept in the debugfs history ring, max 65536, 0 disables it (default: 1024)");
+
+struct ayn_history_header {
+        u32 magic;
+        u16 version;
+        u16 record_size;
+        u32 records;                    /* ring capacity */
+        u32 offset;                     /* of the first record */
+        u64 head;                       /* records written so far */
+        u64 reserved[5];
+};
+
+struct ayn_history_record {
+        u64 time_ns;                    /* CLOCK_BOOTTIME */
+        u64 seq;
+        u8 temp[AYN_TEMP_SENSOR_COUNT]; /* degrees Celsius */
+        u8 pwm;                         /* EC duty cycle */
+        u8 pwm_mode;                    /* EC PWM operating mode */
+        u8 error;                       /* sample failed, values are stale */
+        u16 fan_speed;                  /* RPM */
+        u16 fan_average;                /* RPM */
+        u8 pad[4];
+};
+
+static_assert(sizeof(struct ayn_history_header) == 64);
+static_assert(sizeof(struct ayn_history_record) == 32);
+
+static struct {
+        struct ayn_history_header *header;
+        struct ayn_history_record *records;
+        size_t size;
+} ayn_history;
+
+/* Only called from the sampler, the single writer */
+static void ayn_history_append(const struct ayn_sensor_snapshot *snap)
+{
+        struct ayn_history_header *header = ayn_history.header;
+        struct ayn_history_record *rec;
+        u32 slot;
+        u64 seq;
+
+        if (!header)
+                return;
+
+        seq = header->head;
+        div_u64_rem(seq, header->records, &slot);
+        rec = &ayn_history.records[slot];
+
+        WRITE_ONCE(rec->seq, AYN_HISTORY_SEQ_BUSY);
+        smp_wmb();
+
+        rec->time_ns = ktime_get_boottime_ns();
+        memcpy(rec->temp, snap->temp, sizeof(rec->temp));
+        rec->pwm = snap->pwm;
+        rec->pwm_mode = snap->pwm_mode;
+        rec->error = !!snap->error;
+        rec->fan_speed = snap->fan_speed;
+        rec->fan_average = snap->fan_average;
+
+        smp_wmb();
+        WRITE_ONCE(rec->seq, seq);
+        smp_store_release(&header->head, seq + 1);
+}
+
+static void ayn_history_free(void *data)
+{
+        vfree(ayn_history.header);
+        ayn_history.header = NULL;
+}
+
+static int ayn_history_init(struct device *dev)
+{
+        unsigned int records = min_t(unsigned int, history_records,
+                                     AYN_HISTORY_MAX_RECORDS);
+        struct ayn_history_header *header;
+        size_t size;
+
+        if (!records)
+                return 0;
+
+        size = PAGE_ALIGN(sizeof(*header) +
+                          records * sizeof(struct ayn_history_record));
+        header = vmalloc_user(size);
+        if (!header)
+                return -ENOMEM;
+
+        header->magic = AYN_HISTORY_MAGIC;
+        header->version = AYN_HISTORY_VERSION;
+        header->record_size = sizeof(struct ayn_history_record);
+        header->records = records;
+        header->offset = sizeof(*header);
+
+        ayn_history.records = (void *)header + header->offset;
+        ayn_history.size = size;
+        ayn_history.header = header;
+
+        return devm_add_action_or_reset(dev, ayn_history_free, NULL);
+}
+
+static void ayn_sampler_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ayn_sampler_work, ayn_sampler_fn);
+
+/* Adaptive sampling
+ *
+ * update_interval is the nominal rate. A sample that sees CPU Core or vCore
+ * moving quickly, or the fan ramping, drops the next interval to
+ * sample_min_ms; a sample identical to the previous one doubles it, up to
+ * sample_max_ms. With no reader for AYN_SAMPLE_IDLE_MS, no alarm raised,
+ * no kernel fan control and every thermal zone clear of its trips, the
+ * sampler only feeds the thermal zones and checks the alarms every
+ * sample_idle_ms, or stops until the next read when that is 0 or there are
+ * neither zones nor a hwmon device. Idle never overrides a sample_min_ms
+ * interval.
+ */
+#define AYN_SAMPLE_IDLE_MS              30000
+#define AYN_SAMPLE_TEMP_SLOPE           2       /* degrees per sample */
+#define AYN_SAMPLE_FAN_RAMP             200     /* RPM per sample */
+
+static unsigned int sample_min_ms = AYN_SAMPLE_INTERVAL_MIN_MS;
+module_param(sample_min_ms, uint, 0644);
+MODULE_PARM_DESC(sample_min_ms,
+                 "Sampling interval in ms while temperatures or the fan change quickly (default: 100)");
+
+static unsigned int sample_max_ms = 4000;
+module_param(sample_max_ms, uint, 0644);
+MODULE_PARM_DESC(sample_max_ms,
+                 "Longest sampling interval in ms while readings are stable (default: 4000)");
+
+static unsigned int sample_idle_ms = 10000;
+module_param(sample_idle_ms, uint, 0644);
+MODULE_PARM_DESC(sample_idle_ms,
+                 "Sampling interval in ms with no readers, 0 pauses sampling (default: 10000)");
+
+static struct {
+        spinlock_t lock;
+        bool stopped;                   /* removal or suspend */
+        bool paused;                    /* idle, waits for a reader */
+        unsigned int interval;          /* current interval in ms */
+        unsigned long last_read;        /* jiffies of the last reader */
+        struct ayn_sensor_snapshot prev;
+} ayn_sampler = {
+        .lock = __SPIN_LOCK_UNLOCKED(ayn_sampler.lock),
+        .stopped = true,
+};
+
+/* Nominal sampling interval in ms */
+static unsigned int ayn_sampler_interval(void)
+{
+        return clamp_val(READ_ONCE(update_interval), AYN_SAMPLE_INTERVAL_MIN_MS,
+                         AYN_SAMPLE_INTERVAL_MAX_MS);
+}
+
+/* Interval the sampler is currently running at in ms */
+static unsigned int ayn_sampler_current(void)
+{
+        return READ_ONCE(ayn_sampler.interval) ?: ayn_sampler_interval();
+}
+
+static unsigned long ayn_sampler_delay(void)
+{
+        return msecs_to_jiffies(ayn_sampler_current());
+}
+
+static void ayn_alarms_update(void);
+static bool ayn_alarms_armed(void);
+static bool ayn_alarms_registered(void);
+static void ayn_thermal_update(void);
+static bool ayn_thermal_registered(void);
+static bool ayn_thermal_near_trip(const struct ayn_sensor_snapshot *snap);
+static void ayn_fan_ctl_run(void);
+static bool ayn_fan_ctl_busy(void);
+
+static bool ayn_sampler_idle(const struct ayn_sensor_snapshot *snap)
+{
+        unsigned long last_read = READ_ONCE(ayn_sampler.last_read);
+
+        if (time_before(jiffies, last_read + msecs_to_jiffies(AYN_SAMPLE_IDLE_MS)))
+                return false;
+
+        return !ayn_alarms_armed() && !ayn_fan_ctl_busy() &&
+               !ayn_thermal_near_trip(snap);
+}
+
+/* Interval until the next sample in ms, 0 to pause */
+static unsigned int ayn_sampler_next(const struct ayn_sensor_snapshot *snap)
+{
+        struct ayn_sensor_snapshot *prev = &ayn_sampler.prev;
+        unsigned int min, max, base, interval;
+        bool stable = true;
+        int i;
+
+        min = clamp_val(READ_ONCE(sample_min_ms), AYN_SAMPLE_INTERVAL_MIN_MS,
+                        AYN_SAMPLE_INTERVAL_MAX_MS);
+        max = clamp_val(READ_ONCE(sample_max_ms), min,
+                        AYN_SAMPLE_INTERVAL_MAX_MS);
+        base = clamp_val(ayn_sampler_interval(), min, max);
+        interval = ayn_sampler_current();
+
+        if (snap->error || prev->stamp == 0) {
+                interval = base;
+                goto out;
+        }
+
+        for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++)
+                stable &= snap->temp[i] == prev->temp[i];
+        stable &= abs(snap->fan_speed - prev->fan_speed) < AYN_SAMPLE_FAN_RAMP / 4;
+        stable &= snap->pwm == prev->pwm;
+
+        if (abs(snap->temp[4] - prev->temp[4]) >= AYN_SAMPLE_TEMP_SLOPE ||
+            abs(snap->temp[3] - prev->temp[3]) >= AYN_SAMPLE_TEMP_SLOPE ||
+            abs(snap->fan_speed - prev->fan_speed) >= AYN_SAMPLE_FAN_RAMP ||
+            snap->pwm != prev->pwm)
+                interval = min;
+        else if (stable)
+                interval = clamp(interval * 2, base, max);
+        else
+                interval = base;
+
+        if (interval != min && ayn_sampler_idle(snap)) {
+                if (!ayn_thermal_registered() && !ayn_alarms_registered())
+                        interval = 0;
+                else
+                        interval = READ_ONCE(sample_idle_ms) ?
+                                   clamp_val(READ_ONCE(sample_idle_ms), max,
+                                             AYN_SAMPLE_INTERVAL_MAX_MS) : 0;
+        }
+
+out:
+        if (!snap->error)
+                *prev = *snap;
+        return interval;
+}
+
+static void ayn_sampler_fn(struct work_struct *work)
+{
+        struct ayn_sensor_snapshot snap;
+        unsigned int interval;
+
+        ayn_sample_sensors();
+        ayn_alarms_update();
+        ayn_thermal_update();
+        ayn_fan_ctl_run();
+
+        ayn_snapshot_get(&snap);
+        ayn_history_append(&snap);
+        interval = ayn_sampler_next(&snap);
+
+        spin_lock(&ayn_sampler.lock);
+        if (interval)
+                WRITE_ONCE(ayn_sampler.interval, interval);
+        else
+                ayn_sampler.paused = true;
+        if (interval && !ayn_sampler.stopped)
+                queue_delayed_work(system_freezable_wq, &ayn_sampler_work,
+                                   msecs_to_jiffies(interval));
+        spin_unlock(&ayn_sampler.lock);
+}
+
+/* Run the sampler within delay, unless it is stopped */
+static void ayn_sampler_kick(unsigned long delay)
+{
+        spin_lock(&ayn_sampler.lock);
+        ayn_sampler.paused = false;
+        if (!ayn_sampler.stopped)
+                mod_delayed_work(system_freezable_wq, &ayn_sampler_work, delay);
+        spin_unlock(&ayn_sampler.lock);
+}
+
+/* Snapshot for sysfs and IIO readers, which keep the sampler out of idle.
+ * After a pause or an idle stretch the snapshot is refreshed first. */
+static void ayn_snapshot_read(struct ayn_sensor_snapshot *snap)
+{
+        unsigned int max = clamp_val(READ_ONCE(sample_max_ms),
+                                     AYN_SAMPLE_INTERVAL_MIN_MS,
+                                     AYN_SAMPLE_INTERVAL_MAX_MS);
+        unsigned long fresh;
+
+        fresh = msecs_to_jiffies(2 * min(ayn_sampler_current(), max));
+
+        WRITE_ONCE(ayn_sampler.last_read, jiffies);
+        ayn_snapshot_get(snap);
+        if (!READ_ONCE(ayn_sampler.paused) &&
+            time_before(jiffies, snap->stamp + fresh))
+                return;
+
+        ayn_sampler_kick(0);
+        flush_delayed_work(&ayn_sampler_work);
+        ayn_snapshot_get(snap);
+}
+
+/* The first snapshot is taken in probe, before anything reads it */
+VISIBLE_IF_KUNIT void ayn_sampler_start(void)
+{
+        WRITE_ONCE(ayn_sampler.last_read, jiffies);
+        spin_lock(&ayn_sampler.lock);
+        ayn_sampler.stopped = false;
+        spin_unlock(&ayn_sampler.lock);
+        ayn_sampler_kick(ayn_sampler_delay());
+}
+EXPORT_SYMBOL_IF_KUNIT(ayn_sampler_start);
+
+VISIBLE_IF_KUNIT void ayn_sampler_stop(void *data)
+{
+        spin_lock(&ayn_sampler.lock);
+        ayn_sampler.stopped = true;
+        spin_unlock(&ayn_sampler.lock);
+        cancel_delayed_work_sync(&ayn_sampler_work);
+}
+EXPORT_SYMBOL_IF_KUNIT(ayn_sampler_stop);
+
+/* PWM mode functions */
+/* Callbacks for pwm_auto_point attributes */
+static void ayn_fan_profile_custom(void);
+
+static ssize_t pwm_curve_store(struct device *dev,
+                               struct device_attribute *attr, const char *buf,
+                               size_t count)
+{
+        const struct ayn_ec_reg_desc *desc;
+        int index;
+        int retval;
+        int val;
+
+        retval = kstrtoint(buf, 0, &val);
+        if (retval)
+                return retval;
+
+        index = to_sensor_dev_attr(attr)->index;
+        if (index < 0 || index >= AYN_FAN_CURVE_REGS)
+                return -EINVAL;
+
+        desc = &ayn_desc->auto_point[index];
+        if (val < 0 || val > desc->max)
+                return -EINVAL;
+
+        retval = write_to_ec(desc->reg, val >> desc->shift);
+        if (retval)
+                return retval;
+
+        ayn_fan_profile_custom();
+        return count;
+}
+
+static ssize_t pwm_curve_show(struct device *dev, struct device_attribute *attr,
+                              char *buf)
+{
+        const struct ayn_ec_reg_desc *desc;
+        int index;
+        int retval;
+        long val;
+
+        index = to_sensor_dev_attr(attr)->index;
+        if (index < 0 || index >= AYN_FAN_CURVE_REGS)
+                return -EINVAL;
+
+        desc = &ayn_desc->auto_point[index];
+        retval = read_from_ec_cached(desc->reg, 1, &val);
+        if (retval)
+                return retval;
+
+        return sysfs_emit(buf, "%ld\n", val << desc->shift);
+}
+
+/* Convert between the hwmon [0-255] and EC PWM duty cycle ranges */
+static long ayn_pwm_from_ec(long val)
+{
+        return val << ayn_desc->pwm.shift;
+}
+
+static long ayn_pwm_to_ec(long val)
+{
+        return val >> ayn_desc->pwm.shift;
+}
+
+/* Reflect a PWM register write in the sensor snapshot so readers don't
+ * see the old value until the next sample. */
+static void ayn_pwm_written(u8 reg, u8 val)
+{
+        /* The EC drives the duty cycle itself outside of manual mode */
+        if (reg == AYN_SENSOR_PWM_FAN_ENABLE_REG && val != 0x00)
+                ec_shadow_invalidate(AYN_SENSOR_PWM_FAN_SET_REG, 1);
+
+        write_seqlock(&snapshot_lock);
+        if (reg == AYN_SENSOR_PWM_FAN_ENABLE_REG)
+                snapshot.pwm_mode = val;
+        else
+                snapshot.pwm = val;
+        write_sequnlock(&snapshot_lock);
+}
+
+static int ayn_pwm_write(u8 reg, u8 val)
+{
+        int ret;
+
+        ret = write_to_ec(reg, val);
+        if (ret)
+                return ret;
+
+        ayn_pwm_written(reg, val);
+        return 0;
+}
+
+/* Set the duty cycle, hwmon scale */
+static int ayn_pwm_set(long val)
+{
+        return ayn_pwm_write(ayn_desc->pwm.reg, ayn_pwm_to_ec(val));
+}
+
+/* Manual provides direct control of the PWM */
+static int ayn_pwm_manual(void)
+{
+        return ayn_pwm_write(AYN_SENSOR_PWM_FAN_ENABLE_REG, 0x00);
+}
+
+/* Auto provides EC full control of the PWM */
+static int ayn_pwm_auto(void)
+{
+        return ayn_pwm_write(AYN_SENSOR_PWM_FAN_ENABLE_REG, 0x01);
+}
+
+/* User defined mode allows users to set a custom 5 point
+ * fan curve in the EC which uses the CPU temperature. */
+static int ayn_pwm_user(void)
+{
+        return ayn_pwm_write(AYN_SENSOR_PWM_FAN_ENABLE_REG, 0x02);
+}
+
+/* Whole fan curve callbacks
+ *
+ * pwm1_auto_curve takes all five set points as "temp pwm" pairs in a single
+ * write. Temperatures [0-100] and fan speeds [0-255] must both be
+ * non-decreasing. Only the registers that differ from the shadow are
+ * written, all under one global lock hold, so the EC never picks up a
+ * half-updated curve from a concurrent writer.
+ */
+struct ayn_curve_point {
+        int temp;                       /* degrees Celsius */
+        int pwm;                        /* hwmon scale [0-255] */
+};
+
+/* Parse and validate five "temp pwm" pairs */
+static int ayn_curve_parse(const char *buf, struct ayn_curve_point *curve)
+{
+        int i;
+
+        if (sscanf(buf, "%d %d %d %d %d %d %d %d %d %d",
+                   &curve[0].temp, &curve[0].pwm, &curve[1].temp, &curve[1].pwm,
+                   &curve[2].temp, &curve[2].pwm, &curve[3].temp, &curve[3].pwm,
+                   &curve[4].temp, &curve[4].pwm) != AYN_FAN_CURVE_REGS)
+                return -EINVAL;
+
+        for (i = 0; i < AYN_FAN_CURVE_POINTS; i++) {
+                if (curve[i].temp < 0 ||
+                    curve[i].temp > ayn_desc->auto_point[AYN_FAN_CURVE_POINTS + i].max ||
+                    curve[i].pwm < 0 || curve[i].pwm > ayn_desc->auto_point[i].max)
+                        return -EINVAL;
+                if (i && (curve[i].temp < curve[i - 1].temp ||
+                          curve[i].pwm < curve[i - 1].pwm))
+                        return -EINVAL;
+        }
+
+        return 0;
+}
+
+/* Speed and temperature registers are interleaved */
+static void ayn_curve_to_regs(const struct ayn_curve_point *curve, u8 *regs)
+{
+        int i;
+
+        for (i = 0; i < AYN_FAN_CURVE_POINTS; i++) {
+                regs[i * 2] = curve[i].pwm >> ayn_desc->auto_point[i].shift;
+                regs[i * 2 + 1] = curve[i].temp;
+        }
+}
+
+static int ayn_fan_curve_commit(const u8 *curve)
+{
+        return write_to_ec_block(AYN_SENSOR_PWM_FAN_SPEED_1_REG, curve,
+                                 AYN_FAN_CURVE_REGS);
+}
+
+/* Seed the shadow with the curve the EC currently holds so the first
+ * curve update only writes the points that change. */
+static void ayn_fan_curve_sync_shadow(void)
+{
+        u8 curve[AYN_FAN_CURVE_REGS];
+
+        mutex_lock(&ec_shadow.lock);
+        if (!read_from_ec_bulk(AYN_SENSOR_PWM_FAN_SPEED_1_REG, curve,
+                               AYN_FAN_CURVE_REGS)) {
+                memcpy(&ec_shadow.val[AYN_SENSOR_PWM_FAN_SPEED_1_REG], curve,
+                       AYN_FAN_CURVE_REGS);
+                bitmap_set(ec_shadow.valid, AYN_SENSOR_PWM_FAN_SPEED_1_REG,
+                           AYN_FAN_CURVE_REGS);
+        }
+        mutex_unlock(&ec_shadow.lock);
+}
+
+static ssize_t pwm1_auto_curve_store(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+        struct ayn_curve_point points[AYN_FAN_CURVE_POINTS];
+        u8 curve[AYN_FAN_CURVE_REGS];
+        int retval;
+
+        retval = ayn_curve_parse(buf, points);
+        if (retval)
+                return retval;
+
+        ayn_curve_to_regs(points, curve);
+        retval = ayn_fan_curve_commit(curve);
+        if (retval)
+                return retval;
+
+        ayn_fan_profile_custom();
+        return count;
+}
+
+static ssize_t pwm1_auto_curve_show(struct device *dev,
+                                    struct device_attribute *attr, char *buf)
+{
+        long temp;
+        long pwm;
+        int retval;
+        int len = 0;
+        int i;
+
+        for (i = 0; i < AYN_FAN_CURVE_POINTS; i++) {
+                retval = read_from_ec_cached(AYN_SENSOR_PWM_FAN_SPEED_1_REG + i * 2,
+                                             1, &pwm);
+                if (retval)
+                        return retval;
+                retval = read_from_ec_cached(AYN_SENSOR_PWM_FAN_TEMP_1_REG + i * 2,
+                                             1, &temp);
+                if (retval)
+                        return retval;
+                len += sysfs_emit_at(buf, len, "%s%ld %ld", i ? " " : "",
+                                     temp, pwm << ayn_desc->auto_point[i].shift);
+        }
+        len += sysfs_emit_at(buf, len, "\n");
+
+        return len;
+}
+
+/* Kernel fan controller
+ *
+ * pwm1_enable=3 puts the EC in manual mode and lets the sampler drive the
+ * duty cycle. Every sample the hottest of the pwm1_auto_channels_temp
+ * inputs is run through the EC fan curve, interpolated linearly between
+ * set points. The input only falls once it has dropped pwm1_auto_temp_hyst
+ * degrees below its peak, and the output moves by at most
+ * pwm1_auto_slew_rate units per second. Unchanged outputs are elided by the
+ * shadow, and a failed sensor read runs the fan at full speed.
+ *
+ * pwm1_auto_soft_curve replaces the EC curve with one of up to
+ * AYN_SOFT_CURVE_POINTS set points held by the driver, for finer tuning
+ * than the five EC registers allow.
+ */
+#define AYN_FAN_CTL_HYST_MAX            20
+#define AYN_SOFT_CURVE_POINTS           32
+
+static struct {
+        struct mutex lock;
+        bool enabled;
+        unsigned long channels;         /* bitmask of thermal_sensors[] */
+        unsigned int hyst;              /* degrees Celsius */
+        unsigned int slew_rate;         /* pwm per second, 0 is unlimited */
+        unsigned int slew_credit;       /* slew remainder, pwm * ms */
+        struct ayn_curve_point soft_curve[AYN_SOFT_CURVE_POINTS];
+        int soft_points;                /* 0 follows the EC curve */
+        long temp;                      /* hysteresis tracked input */
+        long pwm;                       /* last output, hwmon scale */
+        long manual_pwm;                /* pwm1 requested in manual mode */
+        unsigned int ramp_rate;         /* manual pwm per second, 0 is immediate */
+        long ramp_pwm;                  /* manual output, -1 is unknown */
+        unsigned int ramp_credit;       /* ramp remainder, pwm * ms */
+        unsigned long cool_state;       /* cooling device state */
+} ayn_fan_ctl = {
+        .lock = __MUTEX_INITIALIZER(ayn_fan_ctl.lock),
+        .channels = BIT(4),             /* CPU Core */
+        .hyst = 3,
+        .slew_rate = 32,
+        .manual_pwm = -1,
+        .ramp_pwm = -1,
+};
+
+/* Move @pwm toward @target by what @rate units per second allow over @ms.
+ * The fraction of a unit left over is carried in @credit, so rates below
+ * one unit per tick are spread over several ticks rather than rounded up.
+ */
+static long ayn_fan_rate_limit(long pwm, long target, unsigned int rate,
+                               unsigned int ms, unsigned int *credit)
+{
+        long step;
+
+        *credit += rate * ms;
+        step = *credit / MSEC_PER_SEC;
+        *credit %= MSEC_PER_SEC;
+
+        /* Nothing to carry over once the target is reached */
+        if (abs(target - pwm) <= step) {
+                *credit = 0;
+                return target;
+        }
+
+        return clamp(target, pwm - step, pwm + step);
+}
+
+/* Cooling devices states map onto the EC duty cycle range */
+#define AYN_FAN_COOL_MAX_STATE          128
+
+/* Lowest duty cycle the thermal core asks for, hwmon scale */
+static long ayn_fan_cool_floor(void)
+{
+        return DIV_ROUND_UP(ayn_fan_ctl.cool_state * 255,
+                            AYN_FAN_COOL_MAX_STATE);
+}
+
+/* Kernel fan control needs regular samples */
+static bool ayn_fan_ctl_busy(void)
+{
+        return READ_ONCE(ayn_fan_ctl.enabled) || READ_ONCE(ayn_fan_ctl.cool_state);
+}
+
+static long ayn_curve_interpolate(const struct ayn_curve_point *curve,
+                                  int count, long temp)
+{
+        int i;
+
+        if (temp <= curve[0].temp)
+                return curve[0].pwm;
+
+        for (i = 1; i < count; i++) {
+                if (temp >= curve[i].temp)
+                        continue;
+                return curve[i - 1].pwm +
+                       (curve[i].pwm - curve[i - 1].pwm) *
+                       (temp - curve[i - 1].temp) /
+                       (curve[i].temp - curve[i - 1].temp);
+        }
+
+        return curve[count - 1].pwm;
+}
+
+/* Current EC fan curve, taken from the shadow and refilled when stale */
+static int ayn_fan_curve_get(struct ayn_curve_point *curve)
+{
+        u8 reg = AYN_SENSOR_PWM_FAN_SPEED_1_REG;
+        u8 *val = &ec_shadow.val[reg];
+        int ret = 0;
+        int i;
+
+        mutex_lock(&ec_shadow.lock);
+        if (find_next_zero_bit(ec_shadow.valid, reg + AYN_FAN_CURVE_REGS, reg) <
+            reg + AYN_FAN_CURVE_REGS) {
+                ret = read_from_ec_bulk(reg, val, AYN_FAN_CURVE_REGS);
+                if (ret) {
+                        bitmap_clear(ec_shadow.valid, reg, AYN_FAN_CURVE_REGS);
+                        goto out;
+                }
+                bitmap_set(ec_shadow.valid, reg, AYN_FAN_CURVE_REGS);
+        }
+
+        /* Same scale as pwm1_auto_curve */
+        for (i = 0; i < AYN_FAN_CURVE_POINTS; i++) {
+                curve[i].pwm = val[i * 2] << ayn_desc->auto_point[i].shift;
+                curve[i].temp = val[i * 2 + 1];
+        }
+out:
+        mutex_unlock(&ec_shadow.lock);
+
+        return ret;
+}
+
+/* A curve the controller can follow rises with temperature and drives the
+ * fan at all. An unset EC curve reads back as zeroes. */
+static bool ayn_curve_usable(const struct ayn_curve_point *curve, int count)
+{
+        int i;
+
+        for (i = 1; i < count; i++) {
+                if (curve[i].temp < curve[i - 1].temp ||
+                    curve[i].pwm < curve[i - 1].pwm)
+                        return false;
+        }
+
+        return curve[count - 1].pwm > 0;
+}
+
+/* Curve the controller follows, the soft curve when set, otherwise the EC
+ * one read into ec_curve. Called with ayn_fan_ctl.lock held. */
+static int ayn_fan_ctl_curve(struct ayn_curve_point *ec_curve,
+                             const struct ayn_curve_point **curve, int *points)
+{
+        int ret;
+
+        if (ayn_fan_ctl.soft_points) {
+                *curve = ayn_fan_ctl.soft_curve;
+                *points = ayn_fan_ctl.soft_points;
+        } else {
+                ret = ayn_fan_curve_get(ec_curve);
+                if (ret)
+                        return ret;
+                *curve = ec_curve;
+                *points = AYN_FAN_CURVE_POINTS;
+        }
+
+        return ayn_curve_usable(*curve, *points) ? 0 : -EINVAL;
+}
+
+static void ayn_fan_ctl_run(void)
+{
+        struct ayn_curve_point ec_curve[AYN_FAN_CURVE_POINTS];
+        const struct ayn_curve_point *curve;
+        struct ayn_sensor_snapshot snap;
+        int points;
+        unsigned long channels;
+        long temp = 0;
+        long target;
+        int i;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        if (!ayn_fan_ctl.enabled)
+                goto out;
+
+        ayn_snapshot_get(&snap);
+        if (snap.error) {
+                target = 255;
+                goto write;
+        }
+
+        /* Full speed rather than following a curve that may stop the fan */
+        if (ayn_fan_ctl_curve(ec_curve, &curve, &points)) {
+                target = 255;
+                goto write;
+        }
+
+        channels = ayn_fan_ctl.channels;
+        for_each_set_bit(i, &channels, AYN_TEMP_SENSOR_COUNT)
+                temp = max_t(long, temp, snap.temp[i]);
+
+        if (temp > ayn_fan_ctl.temp)
+                ayn_fan_ctl.temp = temp;
+        else if (temp + ayn_fan_ctl.hyst < ayn_fan_ctl.temp)
+                ayn_fan_ctl.temp = temp + ayn_fan_ctl.hyst;
+
+        target = ayn_curve_interpolate(curve, points, ayn_fan_ctl.temp);
+
+        if (ayn_fan_ctl.slew_rate)
+                target = ayn_fan_rate_limit(ayn_fan_ctl.pwm, target,
+                                            ayn_fan_ctl.slew_rate,
+                                            ayn_sampler_current(),
+                                            &ayn_fan_ctl.slew_credit);
+
+        /* The thermal core isn't slew limited */
+        target = max(target, ayn_fan_cool_floor());
+
+write:
+        if (!ayn_pwm_set(target))
+                ayn_fan_ctl.pwm = target;
+out:
+        mutex_unlock(&ayn_fan_ctl.lock);
+}
+
+static int ayn_fan_ctl_enable(void)
+{
+        struct ayn_curve_point ec_curve[AYN_FAN_CURVE_POINTS];
+        const struct ayn_curve_point *curve;
+        struct ayn_sensor_snapshot snap;
+        int points;
+        int ret;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        ret = ayn_fan_ctl_curve(ec_curve, &curve, &points);
+        if (!ret)
+                ret = ayn_pwm_manual();
+        if (!ret) {
+                ayn_snapshot_get(&snap);
+                ayn_fan_ctl.pwm = ayn_pwm_from_ec(snap.pwm);
+                ayn_fan_ctl.temp = 0;
+                ayn_fan_ctl.slew_credit = 0;
+                WRITE_ONCE(ayn_fan_ctl.enabled, true);
+        }
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        /* Take over right away rather than on the next sample */
+        if (!ret)
+                ayn_sampler_kick(0);
+
+        return ret;
+}
+
+static void ayn_fan_ctl_disable(void)
+{
+        mutex_lock(&ayn_fan_ctl.lock);
+        WRITE_ONCE(ayn_fan_ctl.enabled, false);
+        mutex_unlock(&ayn_fan_ctl.lock);
+}
+
+/* Don't leave the fan at a fixed duty cycle once nothing drives it */
+static void ayn_fan_ctl_stop(void *data)
+{
+        if (!READ_ONCE(ayn_fan_ctl.enabled))
+                return;
+
+        ayn_fan_ctl_disable();
+        ayn_pwm_auto();
+}
+
+/* Manual mode ramping
+ *
+ * With pwm1_ramp_rate set, a pwm1 write in manual mode moves the duty cycle
+ * toward the new value by at most that many units per second, one step
+ * every AYN_FAN_RAMP_TICK_MS from a delayed work item. The first step is
+ * written right away so EC errors still reach the writer. The cooling
+ * device floor is applied immediately.
+ */
+#define AYN_FAN_RAMP_TICK_MS            100
+
+static void ayn_fan_ramp_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ayn_fan_ramp_work, ayn_fan_ramp_fn);
+
+/* Called with ayn_fan_ctl.lock held */
+static int ayn_fan_ramp_step(void)
+{
+        long floor = ayn_fan_cool_floor();
+        long target = max(ayn_fan_ctl.manual_pwm, floor);
+        long pwm = ayn_fan_ctl.ramp_pwm;
+        int ret;
+
+        if (ayn_fan_ctl.ramp_rate) {
+                pwm = ayn_fan_rate_limit(pwm, target, ayn_fan_ctl.ramp_rate,
+                                         AYN_FAN_RAMP_TICK_MS,
+                                         &ayn_fan_ctl.ramp_credit);
+                pwm = max(pwm, floor);
+        } else {
+                pwm = target;
+        }
+
+        ret = ayn_pwm_set(pwm);
+        if (ret) {
+                /* Start over from the EC value on the next write */
+                ayn_fan_ctl.ramp_pwm = -1;
+                return ret;
+        }
+
+        ayn_fan_ctl.ramp_pwm = pwm;
+        if (pwm != target)
+                queue_delayed_work(system_freezable_wq, &ayn_fan_ramp_work,
+                                   msecs_to_jiffies(AYN_FAN_RAMP_TICK_MS));
+
+        return 0;
+}
+
+static void ayn_fan_ramp_fn(struct work_struct *work)
+{
+        struct ayn_sensor_snapshot snap;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        ayn_snapshot_get(&snap);
+        /* Left manual mode since the last step */
+        if (ayn_fan_ctl.enabled || snap.pwm_mode != 0x00)
+                ayn_fan_ctl.ramp_pwm = -1;
+        else if (ayn_fan_ctl.ramp_pwm >= 0)
+                ayn_fan_ramp_step();
+        mutex_unlock(&ayn_fan_ctl.lock);
+}
+
+static void ayn_fan_ramp_stop(void *data)
+{
+        cancel_delayed_work_sync(&ayn_fan_ramp_work);
+}
+
+/* Manual mode duty cycle, never below the cooling device floor. Called
+ * with ayn_fan_ctl.lock held.
+ */
+static int ayn_fan_manual_apply(void)
+{
+        struct ayn_sensor_snapshot snap;
+
+        ayn_snapshot_get(&snap);
+
+        /* Manual mode was set before the driver loaded */
+        if (ayn_fan_ctl.manual_pwm < 0)
+                ayn_fan_ctl.manual_pwm = ayn_pwm_from_ec(snap.pwm);
+
+        /* Ramp from wherever the duty cycle is now */
+        if (ayn_fan_ctl.ramp_pwm < 0)
+                ayn_fan_ctl.ramp_pwm = ayn_pwm_from_ec(snap.pwm);
+
+        return ayn_fan_ramp_step();
+}
+
+static int ayn_fan_manual_enable(void)
+{
+        struct ayn_sensor_snapshot snap;
+        int ret;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        ret = ayn_pwm_manual();
+        if (!ret) {
+                ayn_snapshot_get(&snap);
+                ayn_fan_ctl.manual_pwm = ayn_pwm_from_ec(snap.pwm);
+                ayn_fan_ctl.ramp_pwm = -1;
+                ret = ayn_fan_manual_apply();
+        }
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        return ret;
+}
+
+static int ayn_fan_manual_write(long val)
+{
+        int ret = 0;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        /* The duty cycle belongs to the kernel controller */
+        if (ayn_fan_ctl.enabled) {
+                ret = -EBUSY;
+                goto out;
+        }
+
+        ayn_fan_ctl.manual_pwm = val;
+        ret = ayn_fan_manual_apply();
+out:
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        return ret;
+}
+
+/* Thermal zones
+ *
+ * The CPU Core, vCore and Battery sensors are registered as thermal zones
+ * fed by the sampler, so the governors run at the sensor update interval
+ * without polling the EC themselves. Active and passive trips are bound to
+ * the fan cooling device; with cpu_cooling passive trips are also bound to
+ * the ACPI processor cooling devices, which would otherwise throttle the
+ * CPU on the battery zone's trip. All trips but the hot one can be changed
+ * from sysfs, so they are read back from the thermal core. The EC
+ * protects the hardware on its own, so there are no critical trips that
+ * would have the thermal core shut the system down on an EC reading; the
+ * hot trip only reports.
+ *
+ * The writable trip mask became a per trip flag in 6.10 and the bind
+ * callbacks were replaced by should_bind in 6.12.
+ */
+#define AYN_TZ_MAX_TRIPS                4
+
+static bool cpu_cooling;
+module_param(cpu_cooling, bool, 0444);
+MODULE_PARM_DESC(cpu_cooling,
+                 "Bind the processor cooling devices to the passive trips (default: false)");
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define AYN_TRIP_RW                     .flags = THERMAL_TRIP_FLAG_RW_TEMP,
+#else
+#define AYN_TRIP_RW
+#endif
+
+#define AYN_TRIP(_type, _temp, _hyst)                   \
+        {                                               \
+                .type = THERMAL_TRIP_##_type,           \
+                .temperature = (_temp) * 1000,          \
+                .hysteresis = (_hyst) * 1000,           \
+                AYN_TRIP_RW                             \
+        }
+
+/* Read only, always the last trip of a zone */
+#define AYN_TRIP_HOT(_temp)                             \
+        {                                               \
+                .type = THERMAL_TRIP_HOT,               \
+                .temperature = (_temp) * 1000,          \
+        }
+
+struct ayn_thermal_zone {
+        const char *type;
+        int sensor;                     /* index in thermal_sensors[] */
+        struct thermal_trip trips[AYN_TZ_MAX_TRIPS];
+        int num_trips;
+        struct thermal_zone_device *tzd;
+};
+
+static struct ayn_thermal_zone ayn_thermal_zones[] = {
+        {
+                .type = "ayn_cpu",
+                .sensor = 4,
+                .trips = {
+                        AYN_TRIP(ACTIVE, 60, 5),
+                        AYN_TRIP(ACTIVE, 75, 5),
+                        AYN_TRIP(PASSIVE, 90, 3),
+                        AYN_TRIP_HOT(105),
+                },
+                .num_trips = 4,
+        },
+        {
+                .type = "ayn_vcore",
+                .sensor = 3,
+                .trips = {
+                        AYN_TRIP(ACTIVE, 70, 5),
+                        AYN_TRIP(PASSIVE, 95, 3),
+                        AYN_TRIP_HOT(110),
+                },
+                .num_trips = 3,
+        },
+        {
+                .type = "ayn_battery",
+                .sensor = 0,
+                .trips = {
+                        AYN_TRIP(ACTIVE, 42, 2),
+                        AYN_TRIP(PASSIVE, 48, 2),
+                        AYN_TRIP_HOT(60),
+                },
+                .num_trips = 3,
+        },
+};
+
+static struct thermal_cooling_device *ayn_fan_cdev;
+
+static int ayn_thermal_get_temp(struct thermal_zone_device *tzd, int *temp)
+{
+        struct ayn_thermal_zone *zone = thermal_zone_device_priv(tzd);
+        struct ayn_sensor_snapshot snap;
+
+        ayn_snapshot_get(&snap);
+        if (snap.error)
+                return snap.error;
+        if (!snap.stamp)
+                return -EAGAIN;         /* not sampled yet */
+
+        *temp = snap.temp[zone->sensor] * 1000;
+        return 0;
+}
+
+static bool ayn_thermal_trip_binds(enum thermal_trip_type type, bool fan)
+{
+        switch (type) {
+        case THERMAL_TRIP_ACTIVE:
+                return fan;
+        case THERMAL_TRIP_PASSIVE:
+                return true;
+        default:
+                return false;
+        }
+}
+
+static bool ayn_thermal_cdev_ours(struct thermal_cooling_device *cdev)
+{
+        return cdev == ayn_fan_cdev ||
+               (cpu_cooling && !strcmp(cdev->type, "Processor"));
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+static bool ayn_thermal_should_bind(struct thermal_zone_device *tzd,
+                                    const struct thermal_trip *trip,
+                                    struct thermal_cooling_device *cdev,
+                                    struct cooling_spec *spec)
+{
+        return ayn_thermal_cdev_ours(cdev) &&
+               ayn_thermal_trip_binds(trip->type, cdev == ayn_fan_cdev);
+}
+#else
+static int ayn_thermal_bind(struct thermal_zone_device *tzd,
+                            struct thermal_cooling_device *cdev)
+{
+        struct ayn_thermal_zone *zone = thermal_zone_device_priv(tzd);
+        int ret;
+        int i;
+
+        if (!ayn_thermal_cdev_ours(cdev))
+                return 0;
+
+        for (i = 0; i < zone->num_trips; i++) {
+                if (!ayn_thermal_trip_binds(zone->trips[i].type,
+                                            cdev == ayn_fan_cdev))
+                        continue;
+
+                ret = thermal_zone_bind_cooling_device(tzd, i, cdev,
+                                                       THERMAL_NO_LIMIT,
+                                                       THERMAL_NO_LIMIT,
+                                                       THERMAL_WEIGHT_DEFAULT);
+                if (ret)
+                        return ret;
+        }
+
+        return 0;
+}
+
+static int ayn_thermal_unbind(struct thermal_zone_device *tzd,
+                              struct thermal_cooling_device *cdev)
+{
+        struct ayn_thermal_zone *zone = thermal_zone_device_priv(tzd);
+        int i;
+
+        if (!ayn_thermal_cdev_ours(cdev))
+                return 0;
+
+        for (i = 0; i < zone->num_trips; i++) {
+                if (!ayn_thermal_trip_binds(zone->trips[i].type,
+                                            cdev == ayn_fan_cdev))
+                        continue;
+
+                thermal_zone_unbind_cooling_device(tzd, i, cdev);
+        }
+
+        return 0;
+}
+#endif
+
+static struct thermal_zone_device_ops ayn_thermal_ops = {
+        .get_temp = ayn_thermal_get_temp,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+        .should_bind = ayn_thermal_should_bind,
+#else
+        .bind = ayn_thermal_bind,
+        .unbind = ayn_thermal_unbind,
+#endif
+};
+
+/* Fan cooling device
+ *
+ * In manual mode and under the kernel controller the cooling state is a
+ * floor for the duty cycle. The EC modes own the fan, so there the state is
+ * only recorded and applied once one of the former is selected. The EC
+ * automatic mode is the default, so out of the box the thermal governors
+ * cannot raise the fan through this device.
+ */
+static int ayn_fan_cool_get_max_state(struct thermal_cooling_device *cdev,
+                                      unsigned long *state)
+{
+        *state = AYN_FAN_COOL_MAX_STATE;
+        return 0;
+}
+
+static int ayn_fan_cool_get_cur_state(struct thermal_cooling_device *cdev,
+                                      unsigned long *state)
+{
+        *state = READ_ONCE(ayn_fan_ctl.cool_state);
+        return 0;
+}
+
+static int ayn_fan_cool_set_cur_state(struct thermal_cooling_device *cdev,
+                                      unsigned long state)
+{
+        struct ayn_sensor_snapshot snap;
+        long floor;
+        int ret = 0;
+
+        if (state > AYN_FAN_COOL_MAX_STATE)
+                return -EINVAL;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        if (ayn_fan_ctl.cool_state == state)
+                goto out;
+
+        WRITE_ONCE(ayn_fan_ctl.cool_state, state);
+        floor = ayn_fan_cool_floor();
+
+        if (ayn_fan_ctl.enabled) {
+                /* Raise now, the controller takes it down on its own pace */
+                if (floor <= ayn_fan_ctl.pwm)
+                        goto out;
+                ret = ayn_pwm_set(floor);
+                if (!ret)
+                        ayn_fan_ctl.pwm = floor;
+                goto out;
+        }
+
+        ayn_snapshot_get(&snap);
+        if (snap.pwm_mode == 0x00)
+                ret = ayn_fan_manual_apply();
+out:
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        return ret;
+}
+
+static const struct thermal_cooling_device_ops ayn_fan_cool_ops = {
+        .get_max_state = ayn_fan_cool_get_max_state,
+        .get_cur_state = ayn_fan_cool_get_cur_state,
+        .set_cur_state = ayn_fan_cool_set_cur_state,
+};
+
+/* Runs from the sampler once a new snapshot is in place */
+static void ayn_thermal_update(void)
+{
+        int i;
+
+        if (!IS_ENABLED(CONFIG_AYN_PLATFORM_THERMAL))
+                return;
+
+        for (i = 0; i < ARRAY_SIZE(ayn_thermal_zones); i++) {
+                if (ayn_thermal_zones[i].tzd)
+                        thermal_zone_device_update(ayn_thermal_zones[i].tzd,
+                                                   THERMAL_EVENT_UNSPECIFIED);
+        }
+}
+
+static bool ayn_thermal_registered(void)
+{
+        int i;
+
+        if (!IS_ENABLED(CONFIG_AYN_PLATFORM_THERMAL))
+                return false;
+
+        for (i = 0; i < ARRAY_SIZE(ayn_thermal_zones); i++) {
+                if (ayn_thermal_zones[i].tzd)
+                        return true;
+        }
+
+        return false;
+}
+
+/* Zones this close to a trip keep the sampler at its regular rate */
+#define AYN_TZ_IDLE_MARGIN              5
+
+/* Stops the walk at the first trip within reach of temp */
+static int ayn_thermal_trip_near(struct thermal_trip *trip, void *data)
+{
+        int *temp = data;
+
+        return *temp >= trip->temperature;
+}
+
+static bool ayn_thermal_near_trip(const struct ayn_sensor_snapshot *snap)
+{
+        struct ayn_thermal_zone *zone;
+        int temp;
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(ayn_thermal_zones); i++) {
+                zone = &ayn_thermal_zones[i];
+                if (!zone->tzd)
+                        continue;
+
+                /* The core keeps its own copy of the trips, sysfs writes
+                 * don't reach zone->trips */
+                temp = (snap->temp[zone->sensor] + AYN_TZ_IDLE_MARGIN) * 1000;
+                if (thermal_zone_for_each_trip(zone->tzd, ayn_thermal_trip_near,
+                                               &temp) > 0)
+                        return true;
+        }
+
+        return false;
+}
+
+static void ayn_thermal_zone_unregister(void *data)
+{
+        struct ayn_thermal_zone *zone = data;
+
+        thermal_zone_device_unregister(zone->tzd);
+        zone->tzd = NULL;
+}
+
+static int ayn_thermal_init(struct device *dev)
+{
+        struct thermal_zone_device *tzd;
+        struct ayn_thermal_zone *zone;
+        int retval;
+        int i;
+
+        if (!IS_ENABLED(CONFIG_AYN_PLATFORM_THERMAL))
+                return 0;
+
+        ayn_fan_cdev = devm_thermal_of_cooling_device_register(dev, NULL,
+                                                               "Fan", NULL,
+                                                               &ayn_fan_cool_ops);
+        if (IS_ERR(ayn_fan_cdev))
+                return PTR_ERR(ayn_fan_cdev);
+
+        for (i = 0; i < ARRAY_SIZE(ayn_thermal_zones); i++) {
+                zone = &ayn_thermal_zones[i];
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+                tzd = thermal_zone_device_register_with_trips(zone->type,
+                                zone->trips, zone->num_trips, zone,
+                                &ayn_thermal_ops, NULL, 0, 0);
+#else
+                /* Passive and active trips are writable */
+                tzd = thermal_zone_device_register_with_trips(zone->type,
+                                zone->trips, zone->num_trips,
+                                GENMASK(zone->num_trips - 2, 0), zone,
+                                &ayn_thermal_ops, NULL, 0, 0);
+#endif
+                if (IS_ERR(tzd))
+                        return PTR_ERR(tzd);
+
+                zone->tzd = tzd;
+                retval = devm_add_action_or_reset(dev,
+                                                  ayn_thermal_zone_unregister,
+                                                  zone);
+                if (retval)
+                        return retval;
+
+                retval = thermal_zone_device_enable(tzd);
+                if (retval)
+                        return retval;
+        }
+
+        return 0;
+}
+
+static ssize_t pwm1_auto_temp_hyst_store(struct device *dev,
+                                         struct device_attribute *attr,
+                                         const char *buf, size_t count)
+{
+        unsigned int val;
+        int retval;
+
+        retval = kstrtouint(buf, 0, &val);
+        if (retval)
+                return retval;
+
+        if (val > AYN_FAN_CTL_HYST_MAX)
+                return -EINVAL;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        ayn_fan_ctl.hyst = val;
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        return count;
+}
+
+static ssize_t pwm1_auto_temp_hyst_show(struct device *dev,
+                                        struct device_attribute *attr,
+                                        char *buf)
+{
+        return sysfs_emit(buf, "%u\n", READ_ONCE(ayn_fan_ctl.hyst));
+}
+
+static ssize_t pwm1_auto_slew_rate_store(struct device *dev,
+                                         struct device_attribute *attr,
+                                         const char *buf, size_t count)
+{
+        unsigned int val;
+        int retval;
+
+        retval = kstrtouint(buf, 0, &val);
+        if (retval)
+                return retval;
+
+        if (val > 255)
+                return -EINVAL;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        ayn_fan_ctl.slew_rate = val;
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        return count;
+}
+
+static ssize_t pwm1_auto_slew_rate_show(struct device *dev,
+                                        struct device_attribute *attr,
+                                        char *buf)
+{
+        return sysfs_emit(buf, "%u\n", READ_ONCE(ayn_fan_ctl.slew_rate));
+}
+
+/* Between two and AYN_SOFT_CURVE_POINTS "temp pwm" pairs, same ranges and
+ * ordering as pwm1_auto_curve. "none" or an empty write goes back to the
+ * EC curve. */
+static int ayn_soft_curve_parse(const char *buf, struct ayn_curve_point *curve)
+{
+        int temp_max = ayn_desc->auto_point[AYN_FAN_CURVE_POINTS].max;
+        int pwm_max = ayn_desc->auto_point[0].max;
+        int count = 0;
+        int len;
+
+        if (sysfs_streq(buf, "none") || sysfs_streq(buf, ""))
+                return 0;
+
+        while (sscanf(buf, "%d %d%n", &curve[count].temp, &curve[count].pwm,
+                      &len) == 2) {
+                if (curve[count].temp < 0 || curve[count].temp > temp_max ||
+                    curve[count].pwm < 0 || curve[count].pwm > pwm_max)
+                        return -EINVAL;
+                if (count && (curve[count].temp < curve[count - 1].temp ||
+                              curve[count].pwm < curve[count - 1].pwm))
+                        return -EINVAL;
+
+                buf += len;
+                if (++count == AYN_SOFT_CURVE_POINTS)
+                        break;
+        }
+
+        /* Anything left over is malformed or one point too many */
+        buf = skip_spaces(buf);
+        if (*buf || count < 2)
+                return -EINVAL;
+
+        return count;
+}
+
+static ssize_t pwm1_auto_soft_curve_store(struct device *dev,
+                                          struct device_attribute *attr,
+                                          const char *buf, size_t count)
+{
+        struct ayn_curve_point curve[AYN_SOFT_CURVE_POINTS];
+        int points;
+
+        points = ayn_soft_curve_parse(buf, curve);
+        if (points < 0)
+                return points;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        memcpy(ayn_fan_ctl.soft_curve, curve, points * sizeof(*curve));
+        ayn_fan_ctl.soft_points = points;
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        ayn_fan_profile_custom();
+        return count;
+}
+
+static ssize_t pwm1_auto_soft_curve_show(struct device *dev,
+                                         struct device_attribute *attr,
+                                         char *buf)
+{
+        int len = 0;
+        int i;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        for (i = 0; i < ayn_fan_ctl.soft_points; i++)
+                len += sysfs_emit_at(buf, len, "%s%d %d", i ? " " : "",
+                                     ayn_fan_ctl.soft_curve[i].temp,
+                                     ayn_fan_ctl.soft_curve[i].pwm);
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        if (!len)
+                len = sysfs_emit(buf, "none");
+        len += sysfs_emit_at(buf, len, "\n");
+
+        return len;
+}
+
+static ssize_t pwm1_ramp_rate_store(struct device *dev,
+                                    struct device_attribute *attr,
+                                    const char *buf, size_t count)
+{
+        unsigned int val;
+        int retval;
+
+        retval = kstrtouint(buf, 0, &val);
+        if (retval)
+                return retval;
+
+        if (val > 255)
+                return -EINVAL;
+
+        mutex_lock(&ayn_fan_ctl.lock);
+        ayn_fan_ctl.ramp_rate = val;
+        mutex_unlock(&ayn_fan_ctl.lock);
+
+        return count;
+}
+
+static ssize_t pwm1_ramp_rate_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf)
+{
+        return sysfs_emit(buf, "%u\n", READ_ONCE(ayn_fan_ctl.ramp_rate));
+}
+
+/* Fan profiles
+ *
+ * Named presets pairing a pwm1_enable mode (0, 2 or 3) with a fan curve.
+ * Selecting one through fan_profile or the platform_profile interface
+ * writes the curve and then the EC mode in a single shadow-elided
+ * transaction. Presets are changed through fan_profile_preset. Writing
+ * pwm1_enable, pwm1, or any of the curves directly leaves the profile
+ * "custom" until one is selected again.
+ */
+enum ayn_fan_profile_id {
+        AYN_FAN_PROFILE_QUIET,
+        AYN_FAN_PROFILE_BALANCED,
+        AYN_FAN_PROFILE_PERFORMANCE,
+        AYN_FAN_PROFILES,
+        AYN_FAN_PROFILE_NONE = -1,      /* never selected */
+        AYN_FAN_PROFILE_CUSTOM = -2,    /* changed since it was selected */
+};
+
+static const char *const ayn_fan_profile_names[] = {
+        [AYN_FAN_PROFILE_QUIET] = "quiet",
+        [AYN_FAN_PROFILE_BALANCED] = "balanced",
+        [AYN_FAN_PROFILE_PERFORMANCE] = "performance",
+};
+
+struct ayn_fan_preset {
+        int mode;                       /* pwm1_enable */
+        struct ayn_curve_point curve[AYN_FAN_CURVE_POINTS];
+};
+
+static struct {
+        struct mutex lock;
+        struct ayn_fan_preset presets[AYN_FAN_PROFILES];
+        int active;                     /* last selected or NONE/CUSTOM */
+} ayn_fan_profile = {
+        .lock = __MUTEX_INITIALIZER(ayn_fan_profile.lock),
+        .presets = {
+                [AYN_FAN_PROFILE_QUIET] = {
+                        2, { { 50, 0 }, { 60, 50 }, { 70, 90 },
+                             { 80, 150 }, { 90, 220 } },
+                },
+                /* Firmware default */
+                [AYN_FAN_PROFILE_BALANCED] = {
+                        0, { { 45, 40 }, { 55, 80 }, { 65, 120 },
+                             { 75, 180 }, { 85, 255 } },
+                },
+                [AYN_FAN_PROFILE_PERFORMANCE] = {
+                        2, { { 40, 80 }, { 50, 120 }, { 60, 170 },
+                             { 70, 220 }, { 80, 255 } },
+                },
+        },
+        .active = AYN_FAN_PROFILE_NONE,
+};
+
+/* pwm1_enable to EC mode, auto (0) doesn't use the curve */
+static const u8 ayn_fan_preset_modes[] = { 0x01, 0x00, 0x02, 0x00 };
+
+/* Called with ayn_fan_profile.lock held */
+static int ayn_fan_profile_apply(int id)
+{
+        static const struct ayn_ec_range ranges[] = {
+                { AYN_SENSOR_PWM_FAN_SPEED_1_REG, AYN_FAN_CURVE_REGS },
+                { AYN_SENSOR_PWM_FAN_ENABLE_REG, 1 },
+        };
+        const struct ayn_fan_preset *preset = &ayn_fan_profile.presets[id];
+        u8 regs[AYN_SENSOR_PWM_FAN_SPEED_1_REG + AYN_FAN_CURVE_REGS -
+                AYN_SENSOR_PWM_FAN_ENABLE_REG];
+        u8 mode = ayn_fan_preset_modes[preset->mode];
+        bool curve = preset->mode != 0;
+        int ret;
+
+        if (preset->mode != 3)
+                ayn_fan_ctl_disable();
+
+        regs[0] = mode;
+        ayn_curve_to_regs(preset->curve, &regs[AYN_SENSOR_PWM_FAN_SPEED_1_REG -
+                                              AYN_SENSOR_PWM_FAN_ENABLE_REG]);
+
+        ret = __write_to_ec_ranges(curve ? ranges : &ranges[1],
+                                   curve ? ARRAY_SIZE(ranges) : 1, regs,
+                                   AYN_SENSOR_PWM_FAN_ENABLE_REG);
+        if (ret)
+                return ret;
+
+        ayn_pwm_written(AYN_SENSOR_PWM_FAN_ENABLE_REG, mode);
+
+        if (preset->mode == 3) {
+                ret = ayn_fan_ctl_enable();
+                if (ret)
+                        return ret;
+        }
+
+        ayn_fan_profile.active = id;
+        return 0;
+}
+
+/* Platform profile
+ *
+ * The fan profiles as platform profile options, custom included from 6.14.
+ */
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_PROFILE)
+
+static const enum platform_profile_option ayn_fan_profile_options[] = {
+        [AYN_FAN_PROFILE_QUIET] = PLATFORM_PROFILE_QUIET,
+        [AYN_FAN_PROFILE_BALANCED] = PLATFORM_PROFILE_BALANCED,
+        [AYN_FAN_PROFILE_PERFORMANCE] = PLATFORM_PROFILE_PERFORMANCE,
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+/* The platform_profile class device, NULL if it failed to register */
+static struct device *ayn_platform_profile_dev;
+#endif
+
+/* Before 6.14 the notification is a no-op while no handler is registered */
+static void ayn_platform_profile_changed(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+        if (ayn_platform_profile_dev)
+                platform_profile_notify(ayn_platform_profile_dev);
+#else
+        platform_profile_notify();
+#endif
+}
+
+static int ayn_platform_profile_read(enum platform_profile_option *profile)
+{
+        int id = READ_ONCE(ayn_fan_profile.active);
+
+        if (id == AYN_FAN_PROFILE_CUSTOM) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+                *profile = PLATFORM_PROFILE_CUSTOM;
+                return 0;
+#else
+                /* No option describes hand tuned settings before 6.14 */
+                return -EINVAL;
+#endif
+        }
+
+        /* Until a profile is picked the EC runs its own, balanced, curve */
+        *profile = ayn_fan_profile_options[id == AYN_FAN_PROFILE_NONE ?
+                                           AYN_FAN_PROFILE_BALANCED : id];
+        return 0;
+}
+
+static int ayn_platform_profile_select(enum platform_profile_option profile)
+{
+        int retval;
+        int id;
+
+        for (id = 0; id < AYN_FAN_PROFILES; id++) {
+                if (ayn_fan_profile_options[id] == profile)
+                        break;
+        }
+        if (id == AYN_FAN_PROFILES)
+                return -EOPNOTSUPP;
+
+        mutex_lock(&ayn_fan_profile.lock);
+        retval = ayn_fan_profile_apply(id);
+        mutex_unlock(&ayn_fan_profile.lock);
+
+        return retval;
+}
+
+/*
+ * From 6.14 every driver registers its own class device and the legacy
+ * platform_profile file aggregates them, before that only the first
+ * handler registered system wide gets it. Failing to register isn't fatal
+ * either way, fan_profile still works.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+static int ayn_platform_profile_get(struct device *dev,
+                                    enum platform_profile_option *profile)
+{
+        return ayn_platform_profile_read(profile);
+}
+
+static int ayn_platform_profile_set(struct device *dev,
+                                    enum platform_profile_option profile)
+{
+        return ayn_platform_profile_select(profile);
+}
+
+static int ayn_platform_profile_probe(void *drvdata, unsigned long *choices)
+{
+        int id;
+
+        for (id = 0; id < AYN_FAN_PROFILES; id++)
+                set_bit(ayn_fan_profile_options[id], choices);
+
+        return 0;
+}
+
+static const struct platform_profile_ops ayn_platform_profile_ops = {
+        .probe = ayn_platform_profile_probe,
+        .profile_get = ayn_platform_profile_get,
+        .profile_set = ayn_platform_profile_set,
+};
+
+static int ayn_platform_profile_init(struct device *dev)
+{
+        struct device *ppdev;
+
+        ayn_platform_profile_dev = NULL;
+
+        ppdev = devm_platform_profile_register(dev, "ayn-platform",
+                                               dev_get_drvdata(dev),
+                                               &ayn_platform_profile_ops);
+        if (IS_ERR(ppdev)) {
+                dev_warn(dev, "failed to register platform profile: %ld\n",
+                         PTR_ERR(ppdev));
+                return 0;
+        }
+
+        ayn_platform_profile_dev = ppdev;
+        return 0;
+}
+#else
+static int ayn_platform_profile_get(struct platform_profile_handler *pprof,
+                                    enum platform_profile_option *profile)
+{
+        return ayn_platform_profile_read(profile);
+}
+
+static int ayn_platform_profile_set(struct platform_profile_handler *pprof,
+                                    enum platform_profile_option profile)
+{
+        return ayn_platform_profile_select(profile);
+}
+
+static struct platform_profile_handler ayn_platform_profile = {
+        .profile_get = ayn_platform_profile_get,
+        .profile_set = ayn_platform_profile_set,
+};
+
+static void ayn_platform_profile_remove(void *data)
+{
+        platform_profile_remove();
+}
+
+static int ayn_platform_profile_init(struct device *dev)
+{
+        int retval;
+        int id;
+
+        for (id = 0; id < AYN_FAN_PROFILES; id++)
+                set_bit(ayn_fan_profile_options[id], ayn_platform_profile.choices);
+
+        retval = platform_profile_register(&ayn_platform_profile);
+        if (retval) {
+                dev_warn(dev, "failed to register platform profile: %d\n",
+                         retval);
+                return 0;
+        }
+
+        return devm_add_action_or_reset(dev, ayn_platform_profile_remove, NULL);
+}
+#endif
+
+#else
+
+static void ayn_platform_profile_changed(void)
+{
+}
+
+static int ayn_platform_profile_init(struct device *dev)
+{
+        return 0;
+}
+
+#endif /* CONFIG_AYN_PLATFORM_PROFILE */
+
+/* The fan settings were changed behind the active profile's back */
+static void ayn_fan_profile_custom(void)
+{
+        bool changed;
+
+        mutex_lock(&ayn_fan_profile.lock);
+        changed = ayn_fan_profile.active != AYN_FAN_PROFILE_CUSTOM;
+        ayn_fan_profile.active = AYN_FAN_PROFILE_CUSTOM;
+        mutex_unlock(&ayn_fan_profile.lock);
+
+        if (changed)
+                ayn_platform_profile_changed();
+}
+
+static ssize_t fan_profile_store(struct device *dev,
+                                 struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+        int retval;
+        int id;
+
+        id = sysfs_match_string(ayn_fan_profile_names, buf);
+        if (id < 0)
+                return id;
+
+        mutex_lock(&ayn_fan_profile.lock);
+        retval = ayn_fan_profile_apply(id);
+        mutex_unlock(&ayn_fan_profile.lock);
+        if (retval)
+                return retval;
+
+        ayn_platform_profile_changed();
+
+        return count;
+}
+
+static ssize_t fan_profile_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+        int id = READ_ONCE(ayn_fan_profile.active);
+
+        if (id == AYN_FAN_PROFILE_NONE)
+                return sysfs_emit(buf, "none\n");
+        if (id == AYN_FAN_PROFILE_CUSTOM)
+                return sysfs_emit(buf, "custom\n");
+
+        return sysfs_emit(buf, "%s\n", ayn_fan_profile_names[id]);
+}
+
+/* "name mode t1 p1 ... t5 p5", applied right away if name is active */
+static ssize_t fan_profile_preset_store(struct device *dev,
+                                        struct device_attribute *attr,
+                                        const char *buf, size_t count)
+{
+        struct ayn_fan_preset preset;
+        char name[16];
+        int retval = 0;
+        int offset;
+        int id;
+
+        if (sscanf(buf, "%15s %d %n", name, &preset.mode, &offset) != 2)
+                return -EINVAL;
+
+        id = match_string(ayn_fan_profile_names, AYN_FAN_PROFILES, name);
+        if (id < 0)
+                return id;
+
+        if (preset.mode != 0 && preset.mode != 2 && preset.mode != 3)
+                return -EINVAL;
+
+        retval = ayn_curve_parse(buf + offset, preset.curve);
+        if (retval)
+                return retval;
+
+        mutex_lock(&ayn_fan_profile.lock);
+        ayn_fan_profile.presets[id] = preset;
+        if (ayn_fan_profile.active == id)
+                retval = ayn_fan_profile_apply(id);
+        mutex_unlock(&ayn_fan_profile.lock);
+        if (retval)
+                return retval;
+
+        return count;
+}
+
+static ssize_t fan_profile_preset_show(struct device *dev,
+                                       struct device_attribute *attr,
+                                       char *buf)
+{
+        const struct ayn_fan_preset *preset;
+        int len = 0;
+        int id;
+        int i;
+
+        mutex_lock(&ayn_fan_profile.lock);
+        for (id = 0; id < AYN_FAN_PROFILES; id++) {
+                preset = &ayn_fan_profile.presets[id];
+                len += sysfs_emit_at(buf, len, "%s %d", ayn_fan_profile_names[id],
+                                     preset->mode);
+                for (i = 0; i < AYN_FAN_CURVE_POINTS; i++)
+                        len += sysfs_emit_at(buf, len, " %d %d",
+                                             preset->curve[i].temp,
+                                             preset->curve[i].pwm);
+                len += sysfs_emit_at(buf, len, "\n");
+        }
+        mutex_unlock(&ayn_fan_profile.lock);
+
+        return len;
+}
+
+static DEVICE_ATTR_RW(fan_profile);
+static DEVICE_ATTR_RW(fan_profile_preset);
+
+static ssize_t fan1_average_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+        struct ayn_sensor_snapshot snap;
+
+        ayn_snapshot_read(&snap);
+        if (snap.error)
+                return snap.error;
+
+        return sysfs_emit(buf, "%u\n", snap.fan_average);
+}
+
+static DEVICE_ATTR_RO(fan1_average);
+
+/* hwmon pwm1_enable value for the snapshot PWM mode */
+static long ayn_pwm_enable_get(const struct ayn_sensor_snapshot *snap)
+{
+        if (READ_ONCE(ayn_fan_ctl.enabled))
+                return 3;
+
+        switch (snap->pwm_mode) {
+        /* EC uses 0 for manual and 1 for automatic,
+           reflect hwmon usage instead */
+        case 0:
+                return 1;
+        case 1:
+                return 0;
+        default:
+                return snap->pwm_mode;
+        }
+}
+
+/* Every sensor from one snapshot as "key=value" lines, using the names and
+ * units of the individual hwmon attributes. age_ms is the snapshot age. */
+static ssize_t sensors_show(struct device *dev, struct device_attribute *attr,
+                            char *buf)
+{
+        struct ayn_sensor_snapshot snap;
+        int len = 0;
+        int i;
+
+        ayn_snapshot_read(&snap);
+        if (snap.error)
+                return snap.error;
+
+        for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++) {
+                len += sysfs_emit_at(buf, len, "temp%d_input=%ld\n", i + 1,
+                                     snap.temp[i] * 1000L);
+                len += sysfs_emit_at(buf, len, "temp%d_label=%s\n", i + 1,
+                                     thermal_sensors[i].name);
+        }
+        len += sysfs_emit_at(buf, len, "fan1_input=%u\n", snap.fan_speed);
+        len += sysfs_emit_at(buf, len, "fan1_average=%u\n", snap.fan_average);
+        len += sysfs_emit_at(buf, len, "pwm1=%ld\n", ayn_pwm_from_ec(snap.pwm));
+        len += sysfs_emit_at(buf, len, "pwm1_enable=%ld\n",
+                             ayn_pwm_enable_get(&snap));
+        len += sysfs_emit_at(buf, len, "age_ms=%u\n",
+                             jiffies_to_msecs(jiffies - snap.stamp));
+
+        return len;
+}
+
+static DEVICE_ATTR_RO(sensors);
+
+/* Fan curve attributes */
+static DEVICE_ATTR_RW(pwm1_auto_curve);
+static DEVICE_ATTR_RW(pwm1_auto_temp_hyst);
+static DEVICE_ATTR_RW(pwm1_auto_slew_rate);
+static DEVICE_ATTR_RW(pwm1_ramp_rate);
+static DEVICE_ATTR_RW(pwm1_auto_soft_curve);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point1_pwm, pwm_curve, 0);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point2_pwm, pwm_curve, 1);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point3_pwm, pwm_curve, 2);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point4_pwm, pwm_curve, 3);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point5_pwm, pwm_curve, 4);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point1_temp, pwm_curve, 5);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point2_temp, pwm_curve, 6);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point3_temp, pwm_curve, 7);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point4_temp, pwm_curve, 8);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point5_temp, pwm_curve, 9);
+
+static struct attribute *ayn_sensors_attrs[] = {
+        &sensor_dev_attr_pwm1_auto_point1_pwm.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point2_pwm.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point3_pwm.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point4_pwm.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point5_pwm.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point1_temp.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point2_temp.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point3_temp.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point4_temp.dev_attr.attr,
+        &sensor_dev_attr_pwm1_auto_point5_temp.dev_attr.attr,
+        &dev_attr_fan1_average.attr,
+        &dev_attr_pwm1_auto_curve.attr,
+        &dev_attr_pwm1_auto_temp_hyst.attr,
+        &dev_attr_pwm1_auto_slew_rate.attr,
+        &dev_attr_pwm1_ramp_rate.attr,
+        &dev_attr_pwm1_auto_soft_curve.attr,
+        &dev_attr_sensors.attr,
+        &dev_attr_fan_profile.attr,
+        &dev_attr_fan_profile_preset.attr,
+        NULL,
+};
+
+ATTRIBUTE_GROUPS(ayn_sensors);
+
+/* Sensor thresholds
+ *
+ * The EC has no limits of its own, so the sampler checks the snapshot
+ * against these and raises the matching alarm attributes. Alarm changes,
+ * and temperature and fan speed changes of at least AYN_TEMP_NOTIFY_DEG and
+ * AYN_FAN_NOTIFY_RPM since the last notification, are signalled through
+ * hwmon_notify_event() so the attributes can be polled.
+ * The fan minimum only applies while the fan is driven. fan1_alarm flags a
+ * stalled fan: a duty cycle of at least AYN_FAN_STALL_PWM with the speed
+ * below AYN_FAN_STALL_RPM for AYN_FAN_STALL_MS, long enough to spin up.
+ */
+#define AYN_TEMP_LIMIT_MAX              127
+#define AYN_TEMP_NOTIFY_DEG             2
+#define AYN_FAN_NOTIFY_RPM              100
+#define AYN_FAN_STALL_PWM               64      /* hwmon scale */
+#define AYN_FAN_STALL_RPM               300
+#define AYN_FAN_STALL_MS                5000
+
+#define AYN_ALARM_TEMP_MAX(i)           BIT(i)
+#define AYN_ALARM_TEMP_CRIT(i)          BIT(AYN_TEMP_SENSOR_COUNT + (i))
+#define AYN_ALARM_FAN_MIN               BIT(2 * AYN_TEMP_SENSOR_COUNT)
+#define AYN_ALARM_FAN_STALL             BIT(2 * AYN_TEMP_SENSOR_COUNT + 1)
+
+static struct device *ayn_hwmon_dev;
+
+static struct {
+        struct mutex lock;
+        long temp_max[AYN_TEMP_SENSOR_COUNT];   /* degrees Celsius */
+        long temp_crit[AYN_TEMP_SENSOR_COUNT];
+        long fan_min;                           /* RPM, 0 is disabled */
+        bool stalling;                          /* driven but not turning */
+        unsigned long stall_since;              /* jiffies */
+        unsigned long alarms;
+        struct ayn_sensor_snapshot last;        /* last notified values */
+} ayn_alarms = {
+        .lock = __MUTEX_INITIALIZER(ayn_alarms.lock),
+        /* Battery, Motherboard, Charger IC, vCore, CPU Core */
+        .temp_max = { 45, 80, 80, 95, 90 },
+        .temp_crit = { 60, 95, 95, 110, 105 },
+};
+
+/* Pollers wait on the alarm attributes without reading, and reading them
+ * already keeps the sampler busy. A raised alarm keeps it out of idle so
+ * they hear it clear in time. */
+static bool ayn_alarms_armed(void)
+{
+        return IS_ENABLED(CONFIG_AYN_PLATFORM_HWMON) &&
+               READ_ONCE(ayn_alarms.alarms);
+}
+
+/* Idle sampling still checks the alarms, so a new one is raised within
+ * sample_idle_ms */
+static bool ayn_alarms_registered(void)
+{
+        return IS_ENABLED(CONFIG_AYN_PLATFORM_HWMON) && READ_ONCE(ayn_hwmon_dev);
+}
+
+static void ayn_alarms_notify(enum hwmon_sensor_types type, u32 attr,
+                              int channel)
+{
+        if (IS_ENABLED(CONFIG_AYN_PLATFORM_HWMON) && ayn_hwmon_dev)
+                hwmon_notify_event(ayn_hwmon_dev, type, attr, channel);
+}
+
+/* Called with ayn_alarms.lock held */
+static void ayn_alarms_check(const struct ayn_sensor_snapshot *snap)
+{
+        unsigned long alarms = 0;
+        unsigned long changed;
+        int i;
+
+        for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++) {
+                if (snap->temp[i] >= ayn_alarms.temp_max[i])
+                        alarms |= AYN_ALARM_TEMP_MAX(i);
+                if (snap->temp[i] >= ayn_alarms.temp_crit[i])
+                        alarms |= AYN_ALARM_TEMP_CRIT(i);
+        }
+
+        if (ayn_alarms.fan_min && snap->pwm &&
+            snap->fan_speed < ayn_alarms.fan_min)
+                alarms |= AYN_ALARM_FAN_MIN;
+
+        if (ayn_pwm_from_ec(snap->pwm) >= AYN_FAN_STALL_PWM &&
+            snap->fan_speed < AYN_FAN_STALL_RPM) {
+                if (!ayn_alarms.stalling) {
+                        ayn_alarms.stalling = true;
+                        ayn_alarms.stall_since = snap->stamp;
+                }
+                if (time_after_eq(snap->stamp, ayn_alarms.stall_since +
+                                  msecs_to_jiffies(AYN_FAN_STALL_MS)))
+                        alarms |= AYN_ALARM_FAN_STALL;
+        } else {
+                ayn_alarms.stalling = false;
+        }
+
+        changed = alarms ^ ayn_alarms.alarms;
+        ayn_alarms.alarms = alarms;
+
+        for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++) {
+                if (changed & AYN_ALARM_TEMP_MAX(i))
+                        ayn_alarms_notify(hwmon_temp, hwmon_temp_max_alarm, i);
+                if (changed & AYN_ALARM_TEMP_CRIT(i))
+                        ayn_alarms_notify(hwmon_temp, hwmon_temp_crit_alarm, i);
+        }
+
+        if (changed & AYN_ALARM_FAN_MIN)
+                ayn_alarms_notify(hwmon_fan, hwmon_fan_min_alarm, 0);
+        if (changed & AYN_ALARM_FAN_STALL)
+                ayn_alarms_notify(hwmon_fan, hwmon_fan_alarm, 0);
+}
+
+static void ayn_alarms_update(void)
+{
+        struct ayn_sensor_snapshot snap;
+        int i;
+
+        /* Alarms are only reported through hwmon */
+        if (!IS_ENABLED(CONFIG_AYN_PLATFORM_HWMON))
+                return;
+
+        ayn_snapshot_get(&snap);
+        if (snap.error)
+                return;
+
+        mutex_lock(&ayn_alarms.lock);
+        ayn_alarms_check(&snap);
+
+        for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++) {
+                if (abs(snap.temp[i] - ayn_alarms.last.temp[i]) >=
+                    AYN_TEMP_NOTIFY_DEG) {
+                        ayn_alarms_notify(hwmon_temp, hwmon_temp_input, i);
+                        ayn_alarms.last.temp[i] = snap.temp[i];
+                }
+        }
+
+        if (abs(snap.fan_speed - ayn_alarms.last.fan_speed) >=
+            AYN_FAN_NOTIFY_RPM) {
+                ayn_alarms_notify(hwmon_fan, hwmon_fan_input, 0);
+                ayn_alarms.last.fan_speed = snap.fan_speed;
+        }
+        mutex_unlock(&ayn_alarms.lock);
+}
+
+static int ayn_alarms_read(u32 attr, int channel, long *val)
+{
+        mutex_lock(&ayn_alarms.lock);
+        switch (attr) {
+        case hwmon_temp_max:
+                *val = ayn_alarms.temp_max[channel] * 1000L;
+                break;
+        case hwmon_temp_crit:
+                *val = ayn_alarms.temp_crit[channel] * 1000L;
+                break;
+        case hwmon_temp_max_alarm:
+                *val = !!(ayn_alarms.alarms & AYN_ALARM_TEMP_MAX(channel));
+                break;
+        case hwmon_temp_crit_alarm:
+                *val = !!(ayn_alarms.alarms & AYN_ALARM_TEMP_CRIT(channel));
+                break;
+        }
+        mutex_unlock(&ayn_alarms.lock);
+
+        return 0;
+}
+
+static int ayn_alarms_write(u32 attr, int channel, long val)
+{
+        struct ayn_sensor_snapshot snap;
+
+        val = clamp_val(val, 0, AYN_TEMP_LIMIT_MAX * 1000L) / 1000;
+
+        mutex_lock(&ayn_alarms.lock);
+        if (attr == hwmon_temp_max)
+                ayn_alarms.temp_max[channel] = val;
+        else
+                ayn_alarms.temp_crit[channel] = val;
+
+        /* Reflect the new limit without waiting for the next sample */
+        ayn_snapshot_get(&snap);
+        if (!snap.error)
+                ayn_alarms_check(&snap);
+        mutex_unlock(&ayn_alarms.lock);
+
+        return 0;
+}
+
+static int ayn_fan_min_write(long val)
+{
+        struct ayn_sensor_snapshot snap;
+
+        mutex_lock(&ayn_alarms.lock);
+        ayn_alarms.fan_min = clamp_val(val, 0, U16_MAX);
+
+        ayn_snapshot_get(&snap);
+        if (!snap.error)
+                ayn_alarms_check(&snap);
+        mutex_unlock(&ayn_alarms.lock);
+
+        return 0;
+}
+
+/* Callbacks for hwmon chip, temp, fan1 and pwm attributes */
+static umode_t ayn_ec_hwmon_is_visible(const void *drvdata,
+                                       enum hwmon_sensor_types type, u32 attr,
+                                       int channel)
+{
+        switch (type) {
+        case hwmon_chip:
+                switch (attr) {
+                case hwmon_chip_update_interval:
+                        return 0644;
+                default:
+                        return 0;
+                }
+        case hwmon_temp:
+                switch (attr) {
+                case hwmon_temp_max:
+                case hwmon_temp_crit:
+                        return 0644;
+                default:
+                        return 0444;
+                }
+        case hwmon_fan:
+                switch (attr) {
+                case hwmon_fan_min:
+                        return 0644;
+                default:
+                        return 0444;
+                }
+        case hwmon_pwm:
+                return 0644;
+        default:
+                return 0;
+        }
+}
+
+VISIBLE_IF_KUNIT int ayn_platform_read(struct device *dev,
+                                       enum hwmon_sensor_types type,
+                                       u32 attr, int channel, long *val)
+{
+        struct ayn_sensor_snapshot snap;
+
+        ayn_snapshot_read(&snap);
+
+        switch (type) {
+        case hwmon_chip:
+                switch (attr) {
+                case hwmon_chip_update_interval:
+                        *val = ayn_sampler_interval();
+                        return 0;
+                default:
+                        break;
+                }
+                break;
+        case hwmon_temp:
+                switch (attr) {
+                case hwmon_temp_input:
+                        if (snap.error)
+                                return snap.error;
+                        /* convert from EC degree to hwmon expected millidegree */
+                        *val = snap.temp[channel] * 1000L;
+                        return 0;
+                case hwmon_temp_max:
+                case hwmon_temp_crit:
+                case hwmon_temp_max_alarm:
+                case hwmon_temp_crit_alarm:
+                        return ayn_alarms_read(attr, channel, val);
+                default:
+                        break;
+                }
+                break;
+        case hwmon_fan:
+                switch (attr) {
+                case hwmon_fan_input:
+                        if (snap.error)
+                                return snap.error;
+                        *val = snap.fan_speed;
+                        return 0;
+                case hwmon_fan_min:
+                        *val = READ_ONCE(ayn_alarms.fan_min);
+                        return 0;
+                case hwmon_fan_min_alarm:
+                        *val = !!(READ_ONCE(ayn_alarms.alarms) &
+                                  AYN_ALARM_FAN_MIN);
+                        return 0;
+                case hwmon_fan_alarm:
+                        *val = !!(READ_ONCE(ayn_alarms.alarms) &
+                                  AYN_ALARM_FAN_STALL);
+                        return 0;
+                default:
+                        break;
+                }
+                break;
+        case hwmon_pwm:
+                switch (attr) {
+                case hwmon_pwm_enable:
+                        if (snap.error)
+                                return snap.error;
+                        *val = ayn_pwm_enable_get(&snap);
+                        return 0;
+                case hwmon_pwm_input:
+                        if (snap.error)
+                                return snap.error;
+                        *val = ayn_pwm_from_ec(snap.pwm);
+                        return 0;
+                case hwmon_pwm_auto_channels_temp:
+                        *val = READ_ONCE(ayn_fan_ctl.channels);
+                        return 0;
+                default:
+                        break;
+                }
+                break;
+        default:
+                break;
+        }
+        return -EOPNOTSUPP;
+}
+EXPORT_SYMBOL_IF_KUNIT(ayn_platform_read);
+
+static int ayn_platform_read_string(struct device *dev,
+                                    enum hwmon_sensor_types type, u32 attr,
+                                    int channel, const char **str)
+{
+        switch (type) {
+        case hwmon_temp:
+                switch (attr) {
+                case hwmon_temp_label:
+                        *str = thermal_sensors[channel].name;
+                        return 0;
+                default:
+                        break;
+                }
+                break;
+        default:
+                break;
+        }
+        return -EOPNOTSUPP;
+}
+
+static int ayn_pwm_enable_write(long val)
+{
+        if (val < 0 || val > 3)
+                return -EINVAL;
+        if (val == 3)
+                return ayn_fan_ctl_enable();
+        ayn_fan_ctl_disable();
+        if (val == 1)
+                return ayn_fan_manual_enable();
+        else if (val == 2)
+                return ayn_pwm_user();
+        return ayn_pwm_auto();
+}
+
+static int ayn_platform_write(struct device *dev, enum hwmon_sensor_types type,
+                              u32 attr, int channel, long val)
+{
+        int ret;
+
+        switch (type) {
+        case hwmon_chip:
+                switch (attr) {
+                case hwmon_chip_update_interval:
+                        val = clamp_val(val, AYN_SAMPLE_INTERVAL_MIN_MS,
+                                        AYN_SAMPLE_INTERVAL_MAX_MS);
+                        WRITE_ONCE(update_interval, val);
+                        /* Restart the adaptive interval from the new rate */
+                        WRITE_ONCE(ayn_sampler.interval, 0);
+                        ayn_sampler_kick(ayn_sampler_delay());
+                        return 0;
+                default:
+                        break;
+                }
+                break;
+        case hwmon_temp:
+                switch (attr) {
+                case hwmon_temp_max:
+                case hwmon_temp_crit:
+                        return ayn_alarms_write(attr, channel, val);
+                default:
+                        break;
+                }
+                break;
+        case hwmon_fan:
+                switch (attr) {
+                case hwmon_fan_min:
+                        return ayn_fan_min_write(val);
+                default:
+                        break;
+                }
+                break;
+        case hwmon_pwm:
+                switch (attr) {
+                case hwmon_pwm_enable:
+                        ret = ayn_pwm_enable_write(val);
+                        if (!ret)
+                                ayn_fan_profile_custom();
+                        return ret;
+                case hwmon_pwm_input:
+                        if (val < 0 || val > ayn_desc->pwm.max)
+                                return -EINVAL;
+                        ret = ayn_fan_manual_write(val);
+                        if (!ret)
+                                ayn_fan_profile_custom();
+                        return ret;
+                case hwmon_pwm_auto_channels_temp:
+                        if (val <= 0 || val >= BIT(AYN_TEMP_SENSOR_COUNT))
+                                return -EINVAL;
+                        WRITE_ONCE(ayn_fan_ctl.channels, val);
+                        return 0;
+                default:
+                        break;
+                }
+                break;
+        default:
+                break;
+        }
+        return -EOPNOTSUPP;
+}
+
+/* RGB LED Logic */
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_LEDS)
+
+/* LED effects engine
+ *
+ * Animations are rendered by the driver instead of userspace pushing every
+ * frame through sysfs. An hrtimer ticks at effect_fps and queues the LED
+ * work, which renders the frame for the current time and writes it through
+ * the coalesced, shadow-elided path, so frames that don't change the color
+ * cost no EC access. Patterns set through the pattern trigger's hw_pattern
+ * run on the same engine.
+ */
+#define AYN_LED_FX_FPS_DEFAULT          30
+#define AYN_LED_FX_FPS_MAX              60
+#define AYN_LED_FX_PERIOD_DEFAULT_MS    3000
+#define AYN_LED_FX_PERIOD_MIN_MS        100
+#define AYN_LED_FX_PERIOD_MAX_MS        60000
+#define AYN_LED_PATTERN_MAX             32
+#define AYN_LED_THERMAL_SENSOR          4   /* CPU Core */
+#define AYN_LED_THERMAL_COLD            40  /* shown blue, degrees Celsius */
+#define AYN_LED_THERMAL_HOT             90  /* shown red, degrees Celsius */
+#define AYN_LED_COLORS                  3
+
+enum ayn_led_effect {
+        AYN_LED_EFFECT_NONE,
+        AYN_LED_EFFECT_RAINBOW,
+        AYN_LED_EFFECT_PULSE,
+        AYN_LED_EFFECT_THERMAL,
+        AYN_LED_EFFECT_PATTERN,
+};
+
+static const char * const ayn_led_effect_names[] = {
+        [AYN_LED_EFFECT_NONE] = "none",
+        [AYN_LED_EFFECT_RAINBOW] = "rainbow",
+        [AYN_LED_EFFECT_PULSE] = "pulse",
+        [AYN_LED_EFFECT_THERMAL] = "thermal",
+        [AYN_LED_EFFECT_PATTERN] = "pattern",
+};
+
+struct ayn_led_fx {
+        struct mutex lock;
+        struct hrtimer timer;
+        enum ayn_led_effect effect;
+        unsigned int fps;
+        unsigned int period_ms;
+        ktime_t start;
+        struct led_pattern pattern[AYN_LED_PATTERN_MAX];
+        u32 pattern_len;
+        int pattern_repeat;
+};
+
+/* Brightness and color changes are applied from a work item. Bursts of
+ * updates, e.g. from triggers or per-frame RGB tools, collapse into a single
+ * EC write of the latest color while the work is pending, and callers of
+ * brightness_set never wait on the EC. */
+struct ayn_led {
+        struct led_classdev_mc mc;
+        struct mc_subled subled[AYN_LED_COLORS];
+        enum led_mode mode;
+        struct work_struct work;
+        struct ayn_led_fx fx;
+};
+
+static struct ayn_led *ayn_led_from_cdev(struct led_classdev *led_cdev)
+{
+        return container_of(lcdev_to_mccdev(led_cdev), struct ayn_led, mc);
+}
+
+/* LED class attributes hang off the LED device, whose drvdata is the
+ * classdev */
+static struct ayn_led *ayn_led_from_dev(struct device *dev)
+{
+        return ayn_led_from_cdev(dev_get_drvdata(dev));
+}
+
+static ktime_t ayn_led_fx_frame_time(struct ayn_led *led)
+{
+        return ns_to_ktime(NSEC_PER_SEC / READ_ONCE(led->fx.fps));
+}
+
+static enum hrtimer_restart ayn_led_fx_timer_fn(struct hrtimer *timer)
+{
+        struct ayn_led *led = container_of(timer, struct ayn_led, fx.timer);
+
+        schedule_work(&led->work);
+        hrtimer_forward_now(timer, ayn_led_fx_frame_time(led));
+        return HRTIMER_RESTART;
+}
+
+static void ayn_led_fx_set(struct ayn_led *led, enum ayn_led_effect effect)
+{
+        mutex_lock(&led->fx.lock);
+        hrtimer_cancel(&led->fx.timer);
+        led->fx.effect = effect;
+        led->fx.start = ktime_get();
+        if (effect != AYN_LED_EFFECT_NONE)
+                hrtimer_start(&led->fx.timer, ayn_led_fx_frame_time(led),
+                              HRTIMER_MODE_REL);
+        mutex_unlock(&led->fx.lock);
+
+        schedule_work(&led->work);
+}
+
+static int led_mode_write(struct ayn_led *led, int mode)
+{
+        int retval;
+
+        retval = write_to_ec(AYN_LED_MODE_REG, mode);
+        if (retval)
+                return retval;
+
+        WRITE_ONCE(led->mode, mode == AYN_LED_MODE_BREATH ? breath : write);
+        return 0;
+};
+
+static ssize_t led_mode_store(struct device *dev, struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+        struct ayn_led *led = ayn_led_from_dev(dev);
+        int val;
+        int retval;
+        int mode;
+
+        retval = kstrtoint(buf, 0, &val);
+        if (retval)
+                return retval;
+
+        if (val) {
+                mode = AYN_LED_MODE_WRITE;
+        } else {
+                mode = AYN_LED_MODE_BREATH;
+                ayn_led_fx_set(led, AYN_LED_EFFECT_NONE);
+        }
+
+        /* Serialize against a frame being written by the LED work */
+        mutex_lock(&led->fx.lock);
+        retval = led_mode_write(led, mode);
+        mutex_unlock(&led->fx.lock);
+        if (retval)
+                return retval;
+
+        return count;
+};
+
+static ssize_t led_mode_show(struct device *dev, struct device_attribute *attr,
+                             char *buf)
+{
+        long mode;
+        int val;
+        int retval;
+
+        retval = read_from_ec(AYN_LED_MODE_REG, 1, &mode);
+        if (retval)
+                return retval;
+        switch (mode) {
+        case AYN_LED_MODE_BREATH:
+                val = breath;
+                break;
+        case AYN_LED_MODE_WRITE:
+        case AYN_LED_MODE_WRITE_ENABLED:
+                val = write;
+                break;
+        default:
+                break;
+        }
+        return sysfs_emit(buf, "%d\n", val);
+};
+
+static DEVICE_ATTR_RW(led_mode);
+
+static ssize_t effect_store(struct device *dev, struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+        struct ayn_led *led = ayn_led_from_dev(dev);
+        int effect;
+        int retval;
+
+        effect = sysfs_match_string(ayn_led_effect_names, buf);
+        if (effect < 0)
+                return effect;
+        /* Patterns are set through the pattern trigger */
+        if (effect == AYN_LED_EFFECT_PATTERN)
+                return -EINVAL;
+
+        if (effect != AYN_LED_EFFECT_NONE && READ_ONCE(led->mode) != write) {
+                retval = led_mode_write(led, AYN_LED_MODE_WRITE);
+                if (retval)
+                        return retval;
+        }
+
+        ayn_led_fx_set(led, effect);
+        return count;
+}
+
+static ssize_t effect_show(struct device *dev, struct device_attribute *attr,
+                           char *buf)
+{
+        struct ayn_led *led = ayn_led_from_dev(dev);
+
+        return sysfs_emit(buf, "%s\n",
+                          ayn_led_effect_names[READ_ONCE(led->fx.effect)]);
+}
+
+static DEVICE_ATTR_RW(effect);
+
+static ssize_t effect_fps_store(struct device *dev,
+                                struct device_attribute *attr, const char *buf,
+                                size_t count)
+{
+        struct ayn_led *led = ayn_led_from_dev(dev);
+        unsigned int val;
+        int retval;
+
+        retval = kstrtouint(buf, 0, &val);
+        if (retval)
+                return retval;
+
+        if (!val || val > AYN_LED_FX_FPS_MAX)
+                return -EINVAL;
+
+        /* Picked up by the timer on its next tick */
+        WRITE_ONCE(led->fx.fps, val);
+        return count;
+}
+
+static ssize_t effect_fps_show(struct device *dev,
+                               struct device_attribute *attr, char *buf)
+{
+        struct ayn_led *led = ayn_led_from_dev(dev);
+
+        return sysfs_emit(buf, "%u\n", READ_ONCE(led->fx.fps));
+}
+
+static DEVICE_ATTR_RW(effect_fps);
+
+static ssize_t effect_period_ms_store(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+        struct ayn_led *led = ayn_led_from_dev(dev);
+        unsigned int val;
+        int retval;
+
+        retval = kstrtouint(buf, 0, &val);
+        if (retval)
+                return retval;
+
+        if (val < AYN_LED_FX_PERIOD_MIN_MS || val > AYN_LED_FX_PERIOD_MAX_MS)
+                return -EINVAL;
+
+        WRITE_ONCE(led->fx.period_ms, val);
+        return count;
+}
+
+static ssize_t effect_period_ms_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+        struct ayn_led *led = ayn_led_from_dev(dev);
+
+        return sysfs_emit(buf, "%u\n", READ_ONCE(led->fx.period_ms));
+}
+
+static DEVICE_ATTR_RW(effect_period_ms);
+
+VISIBLE_IF_KUNIT int ayn_led_regs_write(u8 *regs)
+{
+        regs[AYN_LED_MODE_REG - AYN_LED_MC_R_REG] = AYN_LED_MODE_WRITE;
+        return write_to_ec_block(AYN_LED_MC_R_REG, regs, AYN_LED_REGS);
+}
+EXPORT_SYMBOL_IF_KUNIT(ayn_led_regs_write);
+
+/* Scale the user selected color to brightness */
+static void ayn_led_mc_color(struct led_classdev *led_cdev,
+                             unsigned int brightness, u8 *regs)
+{
+        struct led_classdev_mc *mc_cdev = lcdev_to_mccdev(led_cdev);
+        struct mc_subled s_led;
+        int i;
+
+        for (i = 0; i < mc_cdev->num_colors; i++) {
+                s_led = mc_cdev->subled_info[i];
+                regs[s_led.channel - AYN_LED_MC_R_REG] =
+                        brightness * s_led.intensity / led_cdev->max_brightness;
+        }
+}
+
+static int ayn_led_mc_brightness_write(struct led_classdev *led_cdev,
+                                       enum led_brightness brightness)
+{
+        u8 regs[AYN_LED_REGS];
+
+        ayn_led_mc_color(led_cdev, brightness, regs);
+        return ayn_led_regs_write(regs);
+};
+
+/* hue in [0-1535], six 256 step segments around the color wheel */
+static void ayn_led_fx_hue(unsigned int hue, unsigned int brightness, u8 *regs)
+{
+        unsigned int x = hue & 0xff;
+        unsigned int r;
+        unsigned int g;
+        unsigned int b;
+
+        switch (hue >> 8) {
+        case 0:
+                r = 255; g = x; b = 0;
+                break;
+        case 1:
+                r = 255 - x; g = 255; b = 0;
+                break;
+        case 2:
+                r = 0; g = 255; b = x;
+                break;
+        case 3:
+                r = 0; g = 255 - x; b = 255;
+                break;
+        case 4:
+                r = x; g = 0; b = 255;
+                break;
+        default:
+                r = 255; g = 0; b = 255 - x;
+                break;
+        }
+
+        regs[AYN_LED_MC_R_REG - AYN_LED_MC_R_REG] = r * brightness / 255;
+        regs[AYN_LED_MC_G_REG - AYN_LED_MC_R_REG] = g * brightness / 255;
+        regs[AYN_LED_MC_B_REG - AYN_LED_MC_R_REG] = b * brightness / 255;
+}
+
+/* Pattern brightness at time ms, fading linearly from each step to the next
+ * over the step's delta_t like the software pattern trigger. Caller holds
+ * fx->lock. */
+static unsigned int ayn_led_fx_pattern(struct ayn_led_fx *fx, u64 ms,
+                                       bool *done)
+{
+        struct led_pattern *p = fx->pattern;
+        u32 len = fx->pattern_len;
+        u64 total = 0;
+        u64 pos;
+        u32 i;
+        int from;
+        int to;
+
+        for (i = 0; i < len; i++)
+                total += p[i].delta_t;
+
+        *done = !total || (fx->pattern_repeat > 0 &&
+                           div64_u64_rem(ms, total, &pos) >=
+                           fx->pattern_repeat);
+        if (*done)
+                return p[len - 1].brightness;
+
+        div64_u64_rem(ms, total, &pos);
+        for (i = 0; pos >= p[i].delta_t; i++)
+                pos -= p[i].delta_t;
+
+        from = p[i].brightness;
+        to = p[(i + 1) % len].brightness;
+        return from + (to - from) * (int)pos / (int)p[i].delta_t;
+}
+
+/* Render the frame for the current time into regs. Returns false once a
+ * finite pattern has completed and the timer is no longer needed. */
+static bool ayn_led_fx_render(struct ayn_led *led, u8 *regs)
+{
+        struct led_classdev *led_cdev = &led->mc.led_cdev;
+        struct ayn_led_fx *fx = &led->fx;
+        struct ayn_sensor_snapshot snap;
+        unsigned int brightness = READ_ONCE(led_cdev->brightness);
+        unsigned int period = READ_ONCE(fx->period_ms);
+        unsigned int phase;
+        unsigned int level;
+        bool running = true;
+        u64 ms;
+
+        ms = ktime_to_ms(ktime_sub(ktime_get(), fx->start));
+        div_u64_rem(ms, period, &phase);
+
+        switch (fx->effect) {
+        case AYN_LED_EFFECT_RAINBOW:
+                ayn_led_fx_hue(phase * 1536 / period, brightness, regs);
+                break;
+        case AYN_LED_EFFECT_PULSE:
+                /* triangle wave in [0-255] */
+                level = phase < period / 2 ? phase * 510 / period :
+                                             (period - phase) * 510 / period;
+                ayn_led_mc_color(led_cdev, brightness * level / 255, regs);
+                break;
+        case AYN_LED_EFFECT_THERMAL:
+                ayn_snapshot_get(&snap);
+                level = clamp_val(snap.temp[AYN_LED_THERMAL_SENSOR],
+                                  AYN_LED_THERMAL_COLD, AYN_LED_THERMAL_HOT);
+                level = (level - AYN_LED_THERMAL_COLD) * 255 /
+                        (AYN_LED_THERMAL_HOT - AYN_LED_THERMAL_COLD);
+                /* sweep from blue (hue 1024) back to red (hue 1536) */
+                ayn_led_fx_hue(1024 + level * 2, brightness, regs);
+                break;
+        case AYN_LED_EFFECT_PATTERN:
+                brightness = min(ayn_led_fx_pattern(fx, ms, &running),
+                                 led_cdev->max_brightness);
+                running = !running;
+                ayn_led_mc_color(led_cdev, brightness, regs);
+                break;
+        default:
+                ayn_led_mc_color(led_cdev, brightness, regs);
+                running = false;
+                break;
+        }
+
+        return running;
+}
+
+static int ayn_led_mc_pattern_set(struct led_classdev *led_cdev,
+                                  struct led_pattern *pattern, u32 len,
+                                  int repeat)
+{
+        struct ayn_led *led = ayn_led_from_cdev(led_cdev);
+        int retval;
+
+        if (!len || len > AYN_LED_PATTERN_MAX)
+                return -EINVAL;
+
+        if (READ_ONCE(led->mode) != write) {
+                retval = led_mode_write(led, AYN_LED_MODE_WRITE);
+                if (retval)
+                        return retval;
+        }
+
+        mutex_lock(&led->fx.lock);
+        memcpy(led->fx.pattern, pattern, len * sizeof(*pattern));
+        led->fx.pattern_len = len;
+        led->fx.pattern_repeat = repeat;
+        mutex_unlock(&led->fx.lock);
+
+        ayn_led_fx_set(led, AYN_LED_EFFECT_PATTERN);
+        return 0;
+}
+
+static int ayn_led_mc_pattern_clear(struct led_classdev *led_cdev)
+{
+        ayn_led_fx_set(ayn_led_from_cdev(led_cdev), AYN_LED_EFFECT_NONE);
+        return 0;
+}
+
+static void ayn_led_mc_brightness_set(struct led_classdev *led_cdev,
+                                      enum led_brightness brightness)
+{
+        struct ayn_led *led = ayn_led_from_cdev(led_cdev);
+
+        /* Brightness and intensity changes are ignored in breathing mode */
+        if (READ_ONCE(led->mode) != write)
+                return;
+
+        schedule_work(&led->work);
+};
+
+static enum led_brightness
+ayn_led_mc_brightness_get(struct led_classdev *led_cdev)
+{
+        return led_cdev->brightness;
+};
+
+static struct attribute *ayn_led_mc_attrs[] = {
+        &dev_attr_led_mode.attr,
+        &dev_attr_effect.attr,
+        &dev_attr_effect_fps.attr,
+        &dev_attr_effect_period_ms.attr,
+        NULL,
+};
+
+ATTRIBUTE_GROUPS(ayn_led_mc);
+
+static const struct mc_subled ayn_led_mc_subled_info[AYN_LED_COLORS] = {
+        {
+                .color_index = LED_COLOR_ID_RED,
+                .brightness = 0,
+                .intensity = 0,
+                .channel = AYN_LED_MC_R_REG,
+        },
+        {
+                .color_index = LED_COLOR_ID_GREEN,
+                .brightness = 0,
+                .intensity = 0,
+                .channel = AYN_LED_MC_G_REG,
+        },
+        {
+                .color_index = LED_COLOR_ID_BLUE,
+                .brightness = 0,
+                .intensity = 0,
+                .channel = AYN_LED_MC_B_REG,
+        },
+};
+
+static void ayn_led_mc_work_fn(struct work_struct *work)
+{
+        struct ayn_led *led = container_of(work, struct ayn_led, work);
+        u8 regs[AYN_LED_REGS];
+
+        mutex_lock(&led->fx.lock);
+        if (READ_ONCE(led->mode) == write) {
+                if (!ayn_led_fx_render(led, regs))
+                        hrtimer_cancel(&led->fx.timer);
+                ayn_led_regs_write(regs);
+        }
+        mutex_unlock(&led->fx.lock);
+}
+
+static void ayn_led_mc_stop(void *data)
+{
+        struct ayn_led *led = data;
+
+        hrtimer_cancel(&led->fx.timer);
+        cancel_work_sync(&led->work);
+}
+
+static int ayn_led_init(struct device *dev, struct ayn_led *led)
+{
+        struct led_classdev *led_cdev = &led->mc.led_cdev;
+        int retval;
+
+        mutex_init(&led->fx.lock);
+        led->fx.fps = AYN_LED_FX_FPS_DEFAULT;
+        led->fx.period_ms = AYN_LED_FX_PERIOD_DEFAULT_MS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+        hrtimer_setup(&led->fx.timer, ayn_led_fx_timer_fn, CLOCK_MONOTONIC,
+                      HRTIMER_MODE_REL);
+#else
+        hrtimer_init(&led->fx.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        led->fx.timer.function = ayn_led_fx_timer_fn;
+#endif
+        INIT_WORK(&led->work, ayn_led_mc_work_fn);
+
+        memcpy(led->subled, ayn_led_mc_subled_info, sizeof(led->subled));
+        led->mc.num_colors = AYN_LED_COLORS;
+        led->mc.subled_info = led->subled;
+
+        led_cdev->name = "multicolor:chassis";
+        led_cdev->max_brightness = 255;
+        led_cdev->brightness_set = ayn_led_mc_brightness_set;
+        led_cdev->brightness_get = ayn_led_mc_brightness_get;
+        led_cdev->pattern_set = ayn_led_mc_pattern_set;
+        led_cdev->pattern_clear = ayn_led_mc_pattern_clear;
+
+        /* Added first to run last: unregistering the class device turns
+         * the LED off, which queues the work once more */
+        retval = devm_add_action_or_reset(dev, ayn_led_mc_stop, led);
+        if (retval)
+                return retval;
+
+        retval = devm_led_classdev_multicolor_register(dev, &led->mc);
+        if (retval)
+                return retval;
+
+        retval = devm_device_add_group(led_cdev->dev, *ayn_led_mc_groups);
+        if (retval)
+                return retval;
+
+        /* Switch the LEDs to user mode, off, from the LED work rather than
+         * waiting on the EC here. The mode goes out in the same block as
+         * the colors. */
+        WRITE_ONCE(led->mode, write);
+        schedule_work(&led->work);
+
+        return 0;
+}
+
+/* No frames go out across system sleep, the last one lands before the EC
+ * state is saved */
+static void ayn_led_suspend(struct ayn_led *led)
+{
+        hrtimer_cancel(&led->fx.timer);
+        flush_work(&led->work);
+}
+
+/* Without restored EC state, put the LEDs back in user mode with their
+ * color, then pick the effect up again */
+static int ayn_led_resume(struct ayn_led *led, bool restored)
+{
+        struct led_classdev *led_cdev = &led->mc.led_cdev;
+        int retval = 0;
+
+        if (!restored) {
+                retval = led_mode_write(led, AYN_LED_MODE_WRITE);
+                if (!retval)
+                        retval = ayn_led_mc_brightness_write(led_cdev,
+                                                             led_cdev->brightness);
+        }
+
+        mutex_lock(&led->fx.lock);
+        if (led->fx.effect != AYN_LED_EFFECT_NONE)
+                hrtimer_start(&led->fx.timer, ayn_led_fx_frame_time(led),
+                              HRTIMER_MODE_REL);
+        mutex_unlock(&led->fx.lock);
+
+        return retval;
+}
+
+#else
+
+struct ayn_led {
+};
+
+static int ayn_led_init(struct device *dev, struct ayn_led *led)
+{
+        return 0;
+}
+
+static void ayn_led_suspend(struct ayn_led *led)
+{
+}
+
+static int ayn_led_resume(struct ayn_led *led, bool restored)
+{
+        return 0;
+}
+
+#endif /* CONFIG_AYN_PLATFORM_LEDS */
+
+/* debugfs EC register dump
+ *
+ * ec_dump is a 256 byte image of the EC register space with every range the
+ * driver knows about filled in, and ec_regs a decoded view of the same
+ * data. Each open takes one snapshot under a single global lock hold, so
+ * the dump is consistent and cheap enough to take repeatedly.
+ */
+static const struct ayn_ec_range ayn_debugfs_ranges[] = {
+        /* 0x04-0x21 sensors, PWM, fan curve and fan speed */
+        { AYN_SENSOR_BAT_TEMP_REG,
+          AYN_SENSOR_PWM_FAN_SPEED_REG + 2 - AYN_SENSOR_BAT_TEMP_REG },
+        { AYN_LED_MC_R_REG, AYN_LED_REGS },     /* 0xB0-0xB3 RGB */
+};
+
+static struct dentry *ayn_debugfs_dir;
+
+static int ayn_debugfs_dump(u8 *image)
+{
+        return read_from_ec_ranges(ayn_debugfs_ranges,
+                                   ARRAY_SIZE(ayn_debugfs_ranges), image);
+}
+
+static int ec_dump_open(struct inode *inode, struct file *file)
+{
+        u8 *image;
+        int retval;
+
+        image = kzalloc(AYN_EC_REG_COUNT, GFP_KERNEL);
+        if (!image)
+                return -ENOMEM;
+
+        retval = ayn_debugfs_dump(image);
+        if (retval) {
+                kfree(image);
+                return retval;
+        }
+
+        file->private_data = image;
+        return 0;
+}
+
+static ssize_t ec_dump_read(struct file *file, char __user *buf, size_t count,
+                            loff_t *ppos)
+{
+        return simple_read_from_buffer(buf, count, ppos, file->private_data,
+                                       AYN_EC_REG_COUNT);
+}
+
+static int ec_dump_release(struct inode *inode, struct file *file)
+{
+        kfree(file->private_data);
+        return 0;
+}
+
+static const struct file_operations ec_dump_fops = {
+        .owner = THIS_MODULE,
+        .open = ec_dump_open,
+        .read = ec_dump_read,
+        .release = ec_dump_release,
+        .llseek = default_llseek,
+};
+
+static int ec_regs_show(struct seq_file *m, void *unused)
+{
+        const struct ayn_ec_range *range;
+        u8 image[AYN_EC_REG_COUNT] = {};
+        int retval;
+        int i;
+
+        retval = ayn_debugfs_dump(image);
+        if (retval)
+                return retval;
+
+        for (i = 0; i < ARRAY_SIZE(ayn_debugfs_ranges); i++) {
+                range = &ayn_debugfs_ranges[i];
+                seq_printf(m, "0x%02x: %*ph\n", range->reg, range->len,
+                           &image[range->reg]);
+        }
+        seq_putc(m, '\n');
+
+        for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++)
+                seq_printf(m, "0x%02x %-16s %u C\n", thermal_sensors[i].reg,
+                           thermal_sensors[i].name,
+                           image[thermal_sensors[i].reg]);
+
+        seq_printf(m, "0x%02x %-16s 0x%02x\n", AYN_SENSOR_PWM_FAN_ENABLE_REG,
+                   "PWM mode", image[AYN_SENSOR_PWM_FAN_ENABLE_REG]);
+        seq_printf(m, "0x%02x %-16s %u\n", AYN_SENSOR_PWM_FAN_SET_REG,
+                   "PWM duty", image[AYN_SENSOR_PWM_FAN_SET_REG]);
+        seq_printf(m, "0x%02x %-16s %u RPM\n", AYN_SENSOR_PWM_FAN_SPEED_REG,
+                   "Fan speed", image[AYN_SENSOR_PWM_FAN_SPEED_REG] << 8 |
+                   image[AYN_SENSOR_PWM_FAN_SPEED_REG + 1]);
+
+        for (i = 0; i < AYN_FAN_CURVE_POINTS; i++)
+                seq_printf(m, "0x%02x Curve point %d    %u C duty %u\n",
+                           AYN_SENSOR_PWM_FAN_SPEED_1_REG + i * 2, i + 1,
+                           image[AYN_SENSOR_PWM_FAN_TEMP_1_REG + i * 2],
+                           image[AYN_SENSOR_PWM_FAN_SPEED_1_REG + i * 2]);
+
+        seq_printf(m, "0x%02x %-16s %u %u %u\n", AYN_LED_MC_R_REG, "LED RGB",
+                   image[AYN_LED_MC_R_REG], image[AYN_LED_MC_G_REG],
+                   image[AYN_LED_MC_B_REG]);
+        seq_printf(m, "0x%02x %-16s 0x%02x\n", AYN_LED_MODE_REG, "LED mode",
+                   image[AYN_LED_MODE_REG]);
+
+        return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(ec_regs);
+
+static const char * const ayn_ec_dir_names[] = {
+        [AYN_EC_READ] = "read",
+        [AYN_EC_WRITE] = "write",
+};
+
+static int ec_latency_show(struct seq_file *m, void *unused)
+{
+        int dir;
+        int i;
+
+        seq_printf(m, "%10s", "usec");
+        for (dir = 0; dir < AYN_EC_DIRS; dir++)
+                seq_printf(m, " %5s_lock %7s_io", ayn_ec_dir_names[dir],
+                           ayn_ec_dir_names[dir]);
+        seq_putc(m, '\n');
+
+        for (i = 0; i < AYN_EC_HIST_BUCKETS; i++) {
+                seq_printf(m, "%9lu%s", i ? 1UL << (i - 1) : 0UL,
+                           i == AYN_EC_HIST_BUCKETS - 1 ? "+" : " ");
+                for (dir = 0; dir < AYN_EC_DIRS; dir++)
+                        seq_printf(m, " %10lld %10lld",
+                                   atomic64_read(&ec_hist.lock[dir][i]),
+                                   atomic64_read(&ec_hist.io[dir][i]));
+                seq_putc(m, '\n');
+        }
+
+        return 0;
 }
 
-static int ayn_platform_write(struct device *dev, enum hwmon_sensor_types type,
-                              u32 attr, int channel, long val)
+static int ec_latency_open(struct inode *inode, struct file *file)
 {
-        switch (type) {
-        case hwmon_pwm:
-                switch (attr) {
-                case hwmon_pwm_enable:
-                        if (val == 1)
-                                return ayn_pwm_manual();
-                        else if (val == 2)
-                                return ayn_pwm_user();
-                        else if (val == 0)
-                                return ayn_pwm_auto();
-                        return -EINVAL;
-                case hwmon_pwm_input:
-                        if (val < 0 || val > 255)
-                                return -EINVAL;
-                        switch (model) {
-                        case ayn_loki_max:
-                        case ayn_loki_minipro:
-                        case ayn_loki_zero:
-                                val = val >> 1; /* EC max value is 128 */
-                                break;
-                        default:
-                                break;
-                        }
-                        return write_to_ec(AYN_SENSOR_PWM_FAN_SET_REG, val);
-                default:
-                        break;
+        return single_open(file, ec_latency_show, inode->i_private);
+}
+
+/* Any write clears the histograms */
+static ssize_t ec_latency_write(struct file *file, const char __user *buf,
+                                size_t count, loff_t *ppos)
+{
+        int dir;
+        int i;
+
+        for (dir = 0; dir < AYN_EC_DIRS; dir++) {
+                for (i = 0; i < AYN_EC_HIST_BUCKETS; i++) {
+                        atomic64_set(&ec_hist.lock[dir][i], 0);
+                        atomic64_set(&ec_hist.io[dir][i], 0);
                 }
-                break;
-        default:
-                break;
         }
-        return -EOPNOTSUPP;
+
+        return count;
 }
 
-/* RGB LED Logic */
-static int led_mode_write(int mode)
-{
-        return write_to_ec(AYN_LED_MODE_REG, mode);
+static const struct file_operations ec_latency_fops = {
+        .owner = THIS_MODULE,
+        .open = ec_latency_open,
+        .read = seq_read,
+        .write = ec_latency_write,
+        .llseek = seq_lseek,
+        .release = single_release,
 };
 
-static ssize_t led_mode_store(struct device *dev, struct device_attribute *attr,
-                              const char *buf, size_t count)
+static int ec_errors_show(struct seq_file *m, void *unused)
 {
-        int val;
-        int retval;
-        int mode;
+        seq_printf(m, "lock_timeouts %lld\n",
+                   atomic64_read(&ec_errors.lock_timeouts));
+        seq_printf(m, "unlock_errors %lld\n",
+                   atomic64_read(&ec_errors.unlock_errors));
+        seq_printf(m, "io_errors %lld\n", atomic64_read(&ec_errors.io_errors));
+        seq_printf(m, "retries %lld\n", atomic64_read(&ec_errors.retries));
+        seq_printf(m, "failures %lld\n", atomic64_read(&ec_errors.failures));
 
-        retval = kstrtoint(buf, 0, &val);
-        if (retval)
-                return retval;
+        return 0;
+}
 
-        if (val) {
-                mode = AYN_LED_MODE_WRITE;
-        } else {
-                mode = AYN_LED_MODE_BREATH;
+DEFINE_SHOW_ATTRIBUTE(ec_errors);
+
+/* Registers that were never touched are left out */
+static int ec_stats_show(struct seq_file *m, void *unused)
+{
+        struct ayn_ec_reg_stats *stats;
+        s64 reads, writes, elided, hits, xfers;
+        int reg;
+
+        seq_printf(m, "%4s %10s %10s %10s %10s %10s %8s %8s %12s %8s\n",
+                   "reg", "reads", "writes", "elided", "cache_hits", "xfers",
+                   "errors", "timeouts", "total_us", "max_us");
+
+        for (reg = 0; reg < AYN_EC_REG_COUNT; reg++) {
+                stats = &ec_reg_stats[reg];
+                reads = atomic64_read(&stats->reads);
+                writes = atomic64_read(&stats->writes);
+                elided = atomic64_read(&stats->elided);
+                hits = atomic64_read(&stats->cache_hits);
+                xfers = atomic64_read(&stats->xfers);
+                if (!(reads | writes | elided | hits | xfers |
+                      atomic64_read(&stats->lock_timeouts)))
+                        continue;
+
+                seq_printf(m, "0x%02x %10lld %10lld %10lld %10lld %10lld %8lld %8lld %12llu %8llu\n",
+                           reg, reads, writes, elided, hits, xfers,
+                           atomic64_read(&stats->errors),
+                           atomic64_read(&stats->lock_timeouts),
+                           div_u64(atomic64_read(&stats->time_ns), NSEC_PER_USEC),
+                           div_u64(atomic64_read(&stats->max_ns), NSEC_PER_USEC));
         }
 
-        retval = led_mode_write(mode);
-        if (retval)
-                return retval;
+        return 0;
+}
+
+static int ec_stats_open(struct inode *inode, struct file *file)
+{
+        return single_open(file, ec_stats_show, inode->i_private);
+}
+
+/* Any write clears the counters */
+static ssize_t ec_stats_write(struct file *file, const char __user *buf,
+                              size_t count, loff_t *ppos)
+{
+        struct ayn_ec_reg_stats *stats;
+        int reg;
+
+        for (reg = 0; reg < AYN_EC_REG_COUNT; reg++) {
+                stats = &ec_reg_stats[reg];
+                atomic64_set(&stats->reads, 0);
+                atomic64_set(&stats->writes, 0);
+                atomic64_set(&stats->elided, 0);
+                atomic64_set(&stats->cache_hits, 0);
+                atomic64_set(&stats->xfers, 0);
+                atomic64_set(&stats->errors, 0);
+                atomic64_set(&stats->lock_timeouts, 0);
+                atomic64_set(&stats->time_ns, 0);
+                atomic64_set(&stats->max_ns, 0);
+        }
 
         return count;
+}
+
+static const struct file_operations ec_stats_fops = {
+        .owner = THIS_MODULE,
+        .open = ec_stats_open,
+        .read = seq_read,
+        .write = ec_stats_write,
+        .llseek = seq_lseek,
+        .release = single_release,
 };
 
-static ssize_t led_mode_show(struct device *dev, struct device_attribute *attr,
-                             char *buf)
+/* The history file is created unsafe so mmap reaches it, the handlers
+ * take the debugfs reference themselves. */
+static ssize_t history_read(struct file *file, char __user *buf, size_t count,
+                            loff_t *ppos)
 {
-        long mode;
-        int val;
-        int retval;
+        struct dentry *dentry = file->f_path.dentry;
+        ssize_t ret;
 
-        retval = read_from_ec(AYN_LED_MODE_REG, 1, &mode);
-        if (retval)
-                return retval;
-        switch (mode) {
-        case AYN_LED_MODE_BREATH:
-                val = breath;
-                break;
-        case AYN_LED_MODE_WRITE:
-        case AYN_LED_MODE_WRITE_ENABLED:
-                val = write;
-                break;
-        default:
-                break;
-        }
-        return sysfs_emit(buf, "%d\n", val);
+        ret = debugfs_file_get(dentry);
+        if (ret)
+                return ret;
+
+        ret = simple_read_from_buffer(buf, count, ppos, ayn_history.header,
+                                      ayn_history.size);
+        debugfs_file_put(dentry);
+
+        return ret;
+}
+
+static int history_mmap(struct file *file, struct vm_area_struct *vma)
+{
+        struct dentry *dentry = file->f_path.dentry;
+        int ret;
+
+        if (vma->vm_flags & VM_WRITE)
+                return -EPERM;
+
+        ret = debugfs_file_get(dentry);
+        if (ret)
+                return ret;
+
+        vm_flags_clear(vma, VM_MAYWRITE);
+        /* Mapped pages hold a reference past the buffer going away */
+        ret = remap_vmalloc_range(vma, ayn_history.header, vma->vm_pgoff);
+        debugfs_file_put(dentry);
+
+        return ret;
+}
+
+static const struct file_operations history_fops = {
+        .owner = THIS_MODULE,
+        .open = simple_open,
+        .read = history_read,
+        .mmap = history_mmap,
+        .llseek = default_llseek,
 };
 
-static DEVICE_ATTR_RW(led_mode);
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_EC_MOCK)
+static ssize_t mock_regs_read(struct file *file, char __user *buf,
+                              size_t count, loff_t *ppos)
+{
+        return simple_read_from_buffer(buf, count, ppos, ec_mock.regs,
+                                       AYN_EC_REG_COUNT);
+}
 
-static int ayn_led_mc_brightness_write(struct led_classdev *led_cdev,
-                                       enum led_brightness brightness)
+/* Registers changed behind the driver's back, as firmware would */
+static ssize_t mock_regs_write(struct file *file, const char __user *buf,
+                               size_t count, loff_t *ppos)
 {
-        struct led_classdev_mc *mc_cdev = lcdev_to_mccdev(led_cdev);
-        struct mc_subled s_led;
-        int i;
-        int retval;
-        int val;
+        ssize_t ret;
 
-        for (i = 0; i < mc_cdev->num_colors; i++) {
-                s_led = mc_cdev->subled_info[i];
-                val = brightness * s_led.intensity / led_cdev->max_brightness;
-                retval = write_to_ec(s_led.channel, val);
-                if (retval)
-                        return retval;
+        ret = simple_write_to_buffer(ec_mock.regs, AYN_EC_REG_COUNT, ppos,
+                                     buf, count);
+        if (ret > 0)
+                ec_shadow_invalidate_all();
+
+        return ret;
+}
+
+static const struct file_operations mock_regs_fops = {
+        .owner = THIS_MODULE,
+        .open = simple_open,
+        .read = mock_regs_read,
+        .write = mock_regs_write,
+        .llseek = default_llseek,
+};
+
+static void ayn_debugfs_mock_init(void)
+{
+        struct dentry *dir;
+
+        dir = debugfs_create_dir("mock", ayn_debugfs_dir);
+        debugfs_create_u32("latency_us", 0600, dir, &ec_mock.latency_us);
+        debugfs_create_u32("fail_every", 0600, dir, &ec_mock.fail_every);
+        debugfs_create_file_size("regs", 0600, dir, NULL, &mock_regs_fops,
+                                 AYN_EC_REG_COUNT);
+}
+#else
+static void ayn_debugfs_mock_init(void)
+{
+}
+#endif
+
+static void ayn_debugfs_remove(void *data)
+{
+        debugfs_remove_recursive(ayn_debugfs_dir);
+}
+
+static int ayn_debugfs_init(struct device *dev)
+{
+        ayn_debugfs_dir = debugfs_create_dir("ayn-platform", NULL);
+
+        debugfs_create_file_size("ec_dump", 0400, ayn_debugfs_dir, NULL,
+                                 &ec_dump_fops, AYN_EC_REG_COUNT);
+        debugfs_create_file("ec_regs", 0400, ayn_debugfs_dir, NULL,
+                            &ec_regs_fops);
+        debugfs_create_file("ec_latency", 0600, ayn_debugfs_dir, NULL,
+                            &ec_latency_fops);
+        debugfs_create_file("ec_errors", 0400, ayn_debugfs_dir, NULL,
+                            &ec_errors_fops);
+        debugfs_create_file("ec_stats", 0600, ayn_debugfs_dir, NULL,
+                            &ec_stats_fops);
+        debugfs_create_atomic_t("ec_coalesced", 0400, ayn_debugfs_dir,
+                                &ec_coalesced);
+        if (ayn_history.header)
+                debugfs_create_file_unsafe("history", 0400, ayn_debugfs_dir,
+                                           NULL, &history_fops);
+        if (ayn_ec_is_mock())
+                ayn_debugfs_mock_init();
+
+        return devm_add_action_or_reset(dev, ayn_debugfs_remove, NULL);
+}
+
+/* IIO interface
+ *
+ * Mirrors the hwmon sensors for high rate logging. Direct reads come from
+ * the sampler snapshot; with a trigger attached every scan is a fresh bulk
+ * read of the sensor registers under a single global lock hold, pushed with
+ * its timestamp. Temperatures are in degrees Celsius, the fan speed in RPM
+ * and the duty cycle in raw EC units, each with the matching IIO scale.
+ */
+enum ayn_iio_scan {
+        AYN_IIO_TEMP,
+        AYN_IIO_FAN = AYN_IIO_TEMP + AYN_TEMP_SENSOR_COUNT,
+        AYN_IIO_PWM,
+        AYN_IIO_TIMESTAMP,
+};
+
+#define AYN_IIO_CHAN(_type, _index, _channel, _bits, _extra)            \
+        {                                                               \
+                .type = _type,                                          \
+                .indexed = 1,                                           \
+                .channel = _channel,                                    \
+                .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |          \
+                                      BIT(IIO_CHAN_INFO_SCALE),         \
+                .scan_index = _index,                                   \
+                .scan_type = {                                          \
+                        .sign = 'u',                                    \
+                        .realbits = _bits,                              \
+                        .storagebits = _bits,                           \
+                        .endianness = IIO_CPU,                          \
+                },                                                      \
+                _extra                                                  \
         }
 
-        return write_to_ec(AYN_LED_MODE_REG, AYN_LED_MODE_WRITE);
+#define AYN_IIO_TEMP_CHAN(i)                                            \
+        AYN_IIO_CHAN(IIO_TEMP, AYN_IIO_TEMP + (i), i, 8, )
 
+static const struct iio_chan_spec ayn_iio_channels[] = {
+        AYN_IIO_TEMP_CHAN(0),
+        AYN_IIO_TEMP_CHAN(1),
+        AYN_IIO_TEMP_CHAN(2),
+        AYN_IIO_TEMP_CHAN(3),
+        AYN_IIO_TEMP_CHAN(4),
+        AYN_IIO_CHAN(IIO_ANGL_VEL, AYN_IIO_FAN, 0, 16, ),
+        AYN_IIO_CHAN(IIO_RATIO, AYN_IIO_PWM, 0, 8,
+                     .extend_name = "pwm"),
+        IIO_CHAN_SOFT_TIMESTAMP(AYN_IIO_TIMESTAMP),
 };
 
-static void ayn_led_mc_brightness_set(struct led_classdev *led_cdev,
-                                      enum led_brightness brightness)
+/* Scans are always gathered whole, the core demuxes enabled channels */
+static const unsigned long ayn_iio_scan_masks[] = {
+        GENMASK(AYN_IIO_PWM, AYN_IIO_TEMP),
+        0,
+};
+
+static struct {
+        u8 image[AYN_EC_REG_COUNT];
+        struct {
+                u8 temp[AYN_TEMP_SENSOR_COUNT];
+                u16 fan_speed;
+                u8 pwm;
+                s64 timestamp __aligned(8);
+        } scan;
+} ayn_iio;
+
+static irqreturn_t ayn_iio_trigger_handler(int irq, void *p)
 {
-        long mode;
-        int retval;
+        struct iio_poll_func *pf = p;
+        struct iio_dev *indio_dev = pf->indio_dev;
+        u8 *image = ayn_iio.image;
+        long fan_speed;
+        int i;
 
-        retval = read_from_ec(AYN_LED_MODE_REG, 1, &mode);
-        if (retval)
-                return;
+        if (read_from_ec_settled(ayn_sensor_ranges,
+                                 ARRAY_SIZE(ayn_sensor_ranges),
+                                 AYN_SENSOR_FAN_RANGE, image))
+                goto done;
 
-        switch (mode) {
-        case AYN_LED_MODE_WRITE:
-        case AYN_LED_MODE_WRITE_ENABLED:
-                break;
+        fan_speed = image[AYN_SENSOR_PWM_FAN_SPEED_REG] << 8 |
+                    image[AYN_SENSOR_PWM_FAN_SPEED_REG + 1];
+
+        memset(&ayn_iio.scan, 0, sizeof(ayn_iio.scan));
+        for (i = 0; i < AYN_TEMP_SENSOR_COUNT; i++)
+                ayn_iio.scan.temp[i] = image[thermal_sensors[i].reg];
+        ayn_iio.scan.fan_speed = fan_speed;
+        ayn_iio.scan.pwm = image[AYN_SENSOR_PWM_FAN_SET_REG];
+
+        iio_push_to_buffers_with_timestamp(indio_dev, &ayn_iio.scan,
+                                           pf->timestamp);
+done:
+        iio_trigger_notify_done(indio_dev->trig);
+
+        return IRQ_HANDLED;
+}
+
+static int ayn_iio_read_raw(struct iio_dev *indio_dev,
+                            struct iio_chan_spec const *chan,
+                            int *val, int *val2, long mask)
+{
+        struct ayn_sensor_snapshot snap;
+
+        switch (mask) {
+        case IIO_CHAN_INFO_RAW:
+                ayn_snapshot_read(&snap);
+                if (snap.error)
+                        return snap.error;
+
+                switch (chan->type) {
+                case IIO_TEMP:
+                        *val = snap.temp[chan->channel];
+                        return IIO_VAL_INT;
+                case IIO_ANGL_VEL:
+                        *val = snap.fan_speed;
+                        return IIO_VAL_INT;
+                case IIO_RATIO:
+                        *val = snap.pwm;
+                        return IIO_VAL_INT;
+                default:
+                        return -EINVAL;
+                }
+        case IIO_CHAN_INFO_SCALE:
+                switch (chan->type) {
+                case IIO_TEMP:
+                        /* millidegree Celsius */
+                        *val = 1000;
+                        return IIO_VAL_INT;
+                case IIO_ANGL_VEL:
+                        /* RPM to rad/s, 2 * pi / 60 */
+                        *val = 0;
+                        *val2 = 104719755;
+                        return IIO_VAL_INT_PLUS_NANO;
+                case IIO_RATIO:
+                        /* duty cycle as a fraction of full speed */
+                        *val = ayn_pwm_from_ec(1);
+                        *val2 = 255;
+                        return IIO_VAL_FRACTIONAL;
+                default:
+                        return -EINVAL;
+                }
         default:
-                return;
+                return -EINVAL;
         }
+}
 
-        led_cdev->brightness = brightness;
-        ayn_led_mc_brightness_write(led_cdev, brightness);
+static const struct iio_info ayn_iio_info = {
+        .read_raw = ayn_iio_read_raw,
 };
 
-static enum led_brightness
-ayn_led_mc_brightness_get(struct led_classdev *led_cdev)
+static int ayn_iio_init(struct device *dev)
 {
-        return led_cdev->brightness;
-};
+        struct iio_dev *indio_dev;
+        int retval;
 
-static struct attribute *ayn_led_mc_attrs[] = {
-        &dev_attr_led_mode.attr,
-        NULL,
-};
+        if (!IS_ENABLED(CONFIG_AYN_PLATFORM_IIO))
+                return 0;
 
-ATTRIBUTE_GROUPS(ayn_led_mc);
+        indio_dev = devm_iio_device_alloc(dev, 0);
+        if (!indio_dev)
+                return -ENOMEM;
+
+        indio_dev->name = "aynec";
+        indio_dev->info = &ayn_iio_info;
+        indio_dev->modes = INDIO_DIRECT_MODE;
+        indio_dev->channels = ayn_iio_channels;
+        indio_dev->num_channels = ARRAY_SIZE(ayn_iio_channels);
+        indio_dev->available_scan_masks = ayn_iio_scan_masks;
+
+        retval = devm_iio_triggered_buffer_setup(dev, indio_dev,
+                                                 iio_pollfunc_store_time,
+                                                 ayn_iio_trigger_handler,
+                                                 NULL);
+        if (retval)
+                return retval;
+
+        return devm_iio_device_register(dev, indio_dev);
+}
 
 /* Initialization logic */
+#define AYN_HWMON_TEMP  (HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_MAX | \
+                         HWMON_T_CRIT | HWMON_T_MAX_ALARM | HWMON_T_CRIT_ALARM)
+
 static const struct hwmon_channel_info *ayn_platform_sensors[] = {
-        HWMON_CHANNEL_INFO(fan, HWMON_F_INPUT),
-        HWMON_CHANNEL_INFO(pwm, HWMON_PWM_INPUT | HWMON_PWM_ENABLE),
+        HWMON_CHANNEL_INFO(chip, HWMON_C_UPDATE_INTERVAL),
+        HWMON_CHANNEL_INFO(temp,
+                           AYN_HWMON_TEMP,
+                           AYN_HWMON_TEMP,
+                           AYN_HWMON_TEMP,
+                           AYN_HWMON_TEMP,
+                           AYN_HWMON_TEMP),
+        HWMON_CHANNEL_INFO(fan, HWMON_F_INPUT | HWMON_F_MIN |
+                           HWMON_F_MIN_ALARM | HWMON_F_ALARM),
+        HWMON_CHANNEL_INFO(pwm, HWMON_PWM_INPUT | HWMON_PWM_ENABLE |
+                           HWMON_PWM_AUTO_CHANNELS_TEMP),
         NULL,
 };
 
 static const struct hwmon_ops ayn_ec_hwmon_ops = {
         .is_visible = ayn_ec_hwmon_is_visible,
         .read = ayn_platform_read,
+        .read_string = ayn_platform_read_string,
         .write = ayn_platform_write,
 };
 
@@ -652,100 +4878,196 @@ static const struct hwmon_chip_info ayn_ec_chip_info = {
         .info = ayn_platform_sensors,
 };
 
-struct mc_subled ayn_led_mc_subled_info[] = {
-        {
-                .color_index = LED_COLOR_ID_RED,
-                .brightness = 0,
-                .intensity = 0,
-                .channel = AYN_LED_MC_R_REG,
-        },
-        {
-                .color_index = LED_COLOR_ID_GREEN,
-                .brightness = 0,
-                .intensity = 0,
-                .channel = AYN_LED_MC_G_REG,
-        },
-        {
-                .color_index = LED_COLOR_ID_BLUE,
-                .brightness = 0,
-                .intensity = 0,
-                .channel = AYN_LED_MC_B_REG,
-        },
+/* Per device state
+ *
+ * State that mirrors the single EC (model description, register cache,
+ * shadow, sensor snapshot, sampler, fan control and profiles, alarms,
+ * history, saved sleep state) stays at file scope where the workers and
+ * EC ops reach it without a device, as do the handles the sampler
+ * notifies (hwmon, thermal, IIO, cooling device). What belongs to the
+ * registered device lives here.
+ */
+struct ayn_platform_data {
+        struct ayn_led led;
 };
 
-struct led_classdev_mc ayn_led_mc = {
-        .led_cdev = {
-                .name = "multicolor:chassis",
-                .brightness = 0,
-                .max_brightness = 255,
-                .brightness_set = ayn_led_mc_brightness_set,
-                .brightness_get = ayn_led_mc_brightness_get,
-        },
-        .num_colors = ARRAY_SIZE(ayn_led_mc_subled_info),
-        .subled_info = ayn_led_mc_subled_info,
+/* Writable EC state kept across system sleep, restored in this order so
+ * the fan mode only switches once the duty cycle and curve are in place */
+static const struct ayn_ec_range ayn_pm_ranges[] = {
+        { AYN_SENSOR_PWM_FAN_SPEED_1_REG, AYN_FAN_CURVE_REGS }, /* fan curve */
+        { AYN_SENSOR_PWM_FAN_SET_REG, 1 },      /* duty cycle */
+        { AYN_SENSOR_PWM_FAN_ENABLE_REG, 1 },   /* PWM mode */
+#if IS_ENABLED(CONFIG_AYN_PLATFORM_LEDS)
+        { AYN_LED_MC_R_REG, AYN_LED_REGS },     /* RGB and LED mode */
+#endif
 };
 
-static int ayn_platform_resume(struct platform_device *pdev)
+static struct {
+        u8 image[AYN_EC_REG_COUNT];
+        bool valid;
+} ayn_pm_state;
+
+static int ayn_platform_suspend(struct device *dev)
 {
-        struct led_classdev *led_cdev = &ayn_led_mc.led_cdev;
+        struct ayn_platform_data *data = dev_get_drvdata(dev);
         int retval;
- 
-        retval = led_mode_write(AYN_LED_MODE_WRITE);
-        if (retval)
-                return retval;
 
-        retval = ayn_led_mc_brightness_write(led_cdev, led_cdev->brightness);
+        ayn_sampler_stop(NULL);
+        ayn_led_suspend(&data->led);
+
+        retval = read_from_ec_ranges(ayn_pm_ranges, ARRAY_SIZE(ayn_pm_ranges),
+                                     ayn_pm_state.image);
+        ayn_pm_state.valid = !retval;
+
+        /* User mode reads back as 0x55, but only 0xAA selects it */
+        if (ayn_pm_state.image[AYN_LED_MODE_REG] == AYN_LED_MODE_WRITE_ENABLED)
+                ayn_pm_state.image[AYN_LED_MODE_REG] = AYN_LED_MODE_WRITE;
+
+        /* Not worth failing suspend over, resume falls back to the LEDs */
         if (retval)
-                return retval;
+                dev_warn(dev, "failed to save EC state: %d\n", retval);
 
         return 0;
 }
 
+static int ayn_platform_resume(struct device *dev)
+{
+        struct ayn_platform_data *data = dev_get_drvdata(dev);
+        struct ayn_ec_range ranges[ARRAY_SIZE(ayn_pm_ranges)];
+        u8 *image = ayn_pm_state.image;
+        int count = 0;
+        int retval;
+        int i;
+
+        /* Firmware may have reset the EC, force every register out again */
+        ec_shadow_invalidate_all();
+
+        if (ayn_pm_state.valid) {
+                for (i = 0; i < ARRAY_SIZE(ayn_pm_ranges); i++) {
+                        /* The EC owns the duty cycle outside manual mode */
+                        if (ayn_pm_ranges[i].reg == AYN_SENSOR_PWM_FAN_SET_REG &&
+                            image[AYN_SENSOR_PWM_FAN_ENABLE_REG] != 0x00)
+                                continue;
+                        ranges[count++] = ayn_pm_ranges[i];
+                }
+
+                retval = restore_ec_ranges(ranges, count, image);
+                ayn_led_resume(&data->led, true);
+        } else {
+                retval = ayn_led_resume(&data->led, false);
+        }
+
+        /* Sample the restored state, not what firmware left behind */
+        ayn_sampler_start();
+        return retval;
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(ayn_platform_pm_ops, ayn_platform_suspend,
+                                ayn_platform_resume);
+
 static int ayn_platform_probe(struct platform_device *pdev)
 {
         struct device *dev = &pdev->dev;
+        struct ayn_platform_data *data;
         struct device *hwdev;
         int retval;
 
-        retval = devm_led_classdev_multicolor_register(dev, &ayn_led_mc);
+        data = devm_kzalloc(dev, sizeof(*data), GFP_KERNEL);
+        if (!data)
+                return -ENOMEM;
+        platform_set_drvdata(pdev, data);
+
+        ayn_model_init();
+
+        /* Nothing else depends on the EC state we restore */
+        device_enable_async_suspend(dev);
+
+        retval = ayn_led_init(dev, &data->led);
+        if (retval)
+                return retval;
+
+        ayn_fan_curve_sync_shadow();
+
+        retval = devm_add_action_or_reset(dev, ayn_fan_ctl_stop, NULL);
+        if (retval)
+                return retval;
+
+        retval = devm_add_action_or_reset(dev, ayn_fan_ramp_stop, NULL);
+        if (retval)
+                return retval;
+
+        retval = ayn_thermal_init(dev);
         if (retval)
                 return retval;
 
-        struct led_classdev *led_cdev = &ayn_led_mc.led_cdev;
+        ayn_sample_sensors();
 
-        retval = devm_device_add_group(ayn_led_mc.led_cdev.dev, *ayn_led_mc_groups);
+        retval = ayn_history_init(dev);
         if (retval)
                 return retval;
 
-        retval = led_mode_write(AYN_LED_MODE_WRITE);
+        retval = ayn_debugfs_init(dev);
         if (retval)
                 return retval;
 
-        retval = ayn_led_mc_brightness_write(led_cdev, 0);
+        retval = ayn_iio_init(dev);
         if (retval)
                 return retval;
 
-        hwdev = devm_hwmon_device_register_with_info(
-                dev, "aynec", NULL, &ayn_ec_chip_info, ayn_sensors_groups);
-        return PTR_ERR_OR_ZERO(hwdev);
+        retval = ayn_platform_profile_init(dev);
+        if (retval)
+                return retval;
+
+        if (IS_ENABLED(CONFIG_AYN_PLATFORM_HWMON)) {
+                hwdev = devm_hwmon_device_register_with_info(
+                        dev, "aynec", NULL, &ayn_ec_chip_info,
+                        ayn_sensors_groups);
+                if (IS_ERR(hwdev))
+                        return PTR_ERR(hwdev);
+                ayn_hwmon_dev = hwdev;
+        }
+
+        /* Stopped first on removal, nothing it notifies is gone by then */
+        ayn_sampler_start();
+        return devm_add_action_or_reset(dev, ayn_sampler_stop, NULL);
 }
 
 static struct platform_driver ayn_platform_driver = {
         .driver = {
                 .name = "ayn-platform",
+                .pm = pm_sleep_ptr(&ayn_platform_pm_ops),
+                .probe_type = PROBE_PREFER_ASYNCHRONOUS,
         },
         .probe = ayn_platform_probe,
-        .resume = ayn_platform_resume,
 };
 
 static struct platform_device *ayn_platform_device;
 
 static int __init ayn_platform_init(void)
 {
-        ayn_platform_device = platform_create_bundle(
-                &ayn_platform_driver, ayn_platform_probe, NULL, 0, NULL, 0);
+        int retval;
+
+        retval = ayn_ec_backend_init();
+        if (retval)
+                return retval;
+
+        if (!dmi_check_system(dmi_table) && !ayn_ec_is_mock())
+                return -ENODEV;
+
+        /* platform_create_bundle() probes synchronously, register the
+         * driver and device separately so probe can run async */
+        retval = platform_driver_register(&ayn_platform_driver);
+        if (retval)
+                return retval;
+
+        ayn_platform_device = platform_device_register_simple(
+                "ayn-platform", PLATFORM_DEVID_NONE, NULL, 0);
+        if (IS_ERR(ayn_platform_device)) {
+                platform_driver_unregister(&ayn_platform_driver);
+                return PTR_ERR(ayn_platform_device);
+        }
 
-        return PTR_ERR_OR_ZERO(ayn_platform_device);
+        return 0;
 }
 
 static void __exit ayn_platform_exit(void)
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * EC register map of the Ayn platform driver, shared with its KUnit tests.
+ */
+
+#ifndef _AYN_PLATFORM_H
+#define _AYN_PLATFORM_H
+
+/* EC Teperature Sensors */
+#define AYN_SENSOR_BAT_TEMP_REG         0x04  /* Battery */
+#define AYN_SENSOR_CHARGE_TEMP_REG      0x07  /* Charger IC */
+#define AYN_SENSOR_MB_TEMP_REG          0x05  /* Motherboard */
+#define AYN_SENSOR_PROC_TEMP_REG        0x09  /* CPU Core */
+#define AYN_SENSOR_VCORE_TEMP_REG       0x08  /* vCore */
+
+/* hwmon temp channels, one per EC temperature sensor */
+#define AYN_TEMP_SENSOR_COUNT           5
+
+/* Fan reading and PWM */
+#define AYN_SENSOR_PWM_FAN_ENABLE_REG   0x10  /* PWM operating mode */
+#define AYN_SENSOR_PWM_FAN_SET_REG      0x11  /* PWM duty cycle */
+#define AYN_SENSOR_PWM_FAN_SPEED_REG    0x20  /* Fan speed */
+
+/* EC controlled fan curve registers */
+#define AYN_SENSOR_PWM_FAN_SPEED_1_REG  0x12
+#define AYN_SENSOR_PWM_FAN_SPEED_2_REG  0x14
+#define AYN_SENSOR_PWM_FAN_SPEED_3_REG  0x16
+#define AYN_SENSOR_PWM_FAN_SPEED_4_REG  0x18
+#define AYN_SENSOR_PWM_FAN_SPEED_5_REG  0x1A
+#define AYN_SENSOR_PWM_FAN_TEMP_1_REG   0x13
+#define AYN_SENSOR_PWM_FAN_TEMP_2_REG   0x15
+#define AYN_SENSOR_PWM_FAN_TEMP_3_REG   0x17
+#define AYN_SENSOR_PWM_FAN_TEMP_4_REG   0x19
+#define AYN_SENSOR_PWM_FAN_TEMP_5_REG   0x1B
+
+/* EC Controlled RGB registers */
+#define AYN_LED_MC_B_REG                0xB2 /* Blue, range 0x00-0xFF */
+#define AYN_LED_MC_G_REG                0xB1 /* Green, range 0x00-0xFF */
+#define AYN_LED_MC_R_REG                0xB0 /* Red, range 0x00-0xFF */
+#define AYN_LED_MODE_REG                0xB3 /* RGB Mode */
+
+/* R, G, B and mode registers are contiguous and written as one block */
+#define AYN_LED_REGS                    (AYN_LED_MODE_REG - AYN_LED_MC_R_REG + 1)
+
+/* RGB Mode values */
+#define AYN_LED_MODE_BREATH             0x00 /* Default breathing mode */
+#define AYN_LED_MODE_WRITE              0xAA /* User defined mode */
+#define AYN_LED_MODE_WRITE_ENABLED      0x55 /* Return value when probed */
+
+#endif